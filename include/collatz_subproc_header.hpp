@@ -20,14 +20,33 @@
 #include <concepts>
 #include <algorithm>
 #include <sstream>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <numeric>
+#include <cerrno>
 
 // Windows-specific, for getting the executable location at runtime.
 #ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // Keeps <windows.h> from defining min/max macros, which break std::min/std::max.
+#endif
 #include <windows.h>
 #include <io.h>
 #include <fcntl.h>
 #endif
 
+// POSIX-specific, for memory-mapping the sequence database.
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // For .yaml config file parsing.
 #include "yaml-cpp/yaml.h"
 
@@ -55,6 +74,12 @@ using ImageDimensions = std::pair<uint32_t, uint32_t>;
 /// @brief Range. Values stored as [start, end].
 using Range = std::pair<uint32_t, uint32_t>;
 
+/// @brief Configuration. Holds the configuration information as string key-value pairs.
+using Config = std::unordered_map<std::string, std::string>;
+
+/// @brief Bounding box. Values stored as [Min X, Min Y, Max X, Max Y].
+using BoundingBox = std::array<F32, 4>;
+
 /// @brief Arithmetic. Constrains a type to be of arithmetic type. (e.g. `int`, `float`, `double`)
 template <typename T>
 concept Arithmetic = std::is_arithmetic_v<T>;
@@ -120,6 +145,21 @@ public:
     static F32 getRadians(F32 degrees);
 };
 
+/// @brief A class that holds utilities for multithreading.
+class ThreadUtilities {
+public:
+    /// @brief Returns the number of threads to use. Always at least 1.
+    static size_t getThreadCount();
+
+    /// @brief Runs a task over [0, count) in chunks, spread across `getThreadCount()` threads.
+    /// @details Chunks are handed out dynamically, so uneven chunks (e.g. long sequences) still balance out.
+    /// The first exception thrown by any thread is rethrown on the calling thread.
+    /// @param count The number of items.
+    /// @param chunkSize The number of items handed to a thread at a time.
+    /// @param task Called as `task(threadIndex, begin, end)`. A thread index is only ever used by one thread.
+    static void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t, size_t)> &task);
+};
+
 /// @brief A class that holds utilities for colors.
 class ColorUtilities {
 public:
@@ -148,7 +188,19 @@ public:
 class ConfigUtilities {
 public:
 
+    /// @brief Settings that may be omitted from the configuration file, with their default values.
+    static inline const std::unordered_map<std::string, std::string> optionalSettings = {
+        {"database-bound", "0"},
+        {"render-mode", "Segments"},
+        {"tone-mapping", "Logarithmic"},
+        {"gradient", "#000000FF, #FFFFFFFF"},
+        {"generation", "Forward"},
+        {"tree-depth", "30"},
+        {"level-of-detail", "Merge"},
+    };
+
     /// @brief Extracts the configuration file's information as strings in key-value pairs.
+    /// @details Settings in `optionalSettings` take their default value if missing.
     /// @param configPath Path to the `.yaml` configuration file.
     /// @return A map to the configuration file's information in key-value pairs.
     static std::unordered_map<std::string, std::string> getConfig(const fs::path &configPath);
@@ -173,23 +225,176 @@ public:
     /// @return An `RGBA` color value.
     static RGBA getRGBA(const std::string &rgbaHex);
     
+    /// @brief Gets the `Gradient` from a string holding two comma-separated RGBA hex codes.
+    /// @param gradientHex A string containing the start and end colors of a gradient. (e.g. "#000000FF, #FFFFFFFF")
+    /// @return A `Gradient` color value.
+    static Gradient getGradient(const std::string &gradientHex);
+
     /// @brief Gets the path of the running executable.
     /// @return Returns the path of the running executable.
     static fs::path getExecutablePath();
 };
 
+/// @brief A single entry of a batch request.
+struct BatchEntry {
+
+    /// @brief The range to evaluate.
+    Range range;
+
+    /// @brief The number of values to sample in "Random" mode.
+    uint32_t sampleSize;
+
+    /// @brief The configuration with the entry's overrides applied.
+    Config config;
+
+    /// @brief Indices of the entry's values in the batch's shared sequences.
+    std::vector<size_t> indices;
+
+    /// @brief Why the entry failed. Empty if it has not.
+    std::string error;
+};
+
+/// @brief Trajectory statistics of a single n.
+struct TrajectoryStats {
+
+    /// @brief The largest value reached.
+    uint64_t maxValue;
+
+    /// @brief The number of steps to reach 1.
+    uint32_t stoppingTime;
+
+    /// @brief The number of odd steps (3n + 1) to reach 1.
+    uint32_t oddSteps;
+};
+
+/// @brief Geometry settings taken from the configuration, shared by every render mode.
+struct GeometrySettings {
+
+    /// @brief The maximum length of a segment.
+    F32 lineLength;
+
+    /// @brief The width of a segment.
+    F32 lineWidth;
+
+    /// @brief The turn taken at an odd value, in radians.
+    F32 angleIfOdd;
+
+    /// @brief The turn taken at an even value, in radians.
+    F32 angleIfEven;
+
+    /// @brief Whether the segment length decays at every step.
+    bool isLogarithmic;
+
+    /// @brief The length of one pixel. Consecutive shorter segments are merged into one per pixel. 0 to disable.
+    F32 pixelFootprint;
+};
+
+/// @brief Called for every traced segment as `onSegment(threadIndex, x1, y1, x2, y2, theta)`.
+using SegmentCallback = std::function<void(size_t, F32, F32, F32, F32, F32)>;
+
+/// @brief Traces every segment of an image in parallel, calling the given `SegmentCallback` for each.
+using SegmentSource = std::function<void(const SegmentCallback &)>;
+
+/// @brief A node of the inverse Collatz tree, holding the state its children are drawn from.
+struct TreeNode {
+
+    /// @brief The value of the node.
+    uint64_t value;
+
+    /// @brief The position of the node.
+    F32 x;
+    F32 y;
+
+    /// @brief The heading of the segment leading into the node, in radians.
+    F32 theta;
+
+    /// @brief The length of the segments leading out of the node.
+    F32 length;
+};
+
 /// @brief A class holding the main utilities for the main `Subprocess` class.
 class SubprocessUtilities {
 public:
 
+    /// @brief The factor the segment length is multiplied by at every step with "Logarithmic" scaling.
+    static constexpr F32 decay = 0.99f;
+
+    /// @brief The number of pixels left blank around the image, divided between both sides. Same as the parent process.
+    static constexpr uint32_t paddingSize = 200;
+
+    /// @brief Walks the centerline of a hailstone sequence, starting at 1 and moving outward to n.
+    /// @details Runs of segments shorter than `settings.pixelFootprint` are merged into a single chord
+    /// once their combined length reaches it, so no point of a run strays more than a pixel from its chord.
+    /// @tparam F Callable as `onSegment(x1, y1, x2, y2, theta)`.
+    /// @param sequence The hailstone sequence to trace.
+    /// @param settings The geometry settings to trace with.
+    /// @param onSegment Called for every segment, from the segment (1 -> 2) outward.
+    template <typename F>
+    static void traceSequence(const std::vector<uint64_t> &sequence, const GeometrySettings &settings, F &&onSegment) {
+        F32 currentLineLength = settings.lineLength;
+        F32 currentTheta = MathUtilities::getRadians(90.0);
+        F32 x = 0.0f, y = 0.0f;
+
+        // Start and combined length of the run of sub-pixel segments not yet passed on.
+        F32 runX = 0.0f, runY = 0.0f, runLength = 0.0f;
+        const auto flushRun = [&](F32 endX, F32 endY) {
+            onSegment(runX, runY, endX, endY, std::atan2(endY - runY, endX - runX));
+            runLength = 0.0f;
+        };
+        for (size_t j = sequence.size() - 1; j > 0; --j) {
+            const F32 theta = ((sequence[j] & 0b1) == 0b1 ? settings.angleIfOdd : settings.angleIfEven) + currentTheta;
+            const F32 nextX = x + currentLineLength * std::cos(theta);
+            const F32 nextY = y + currentLineLength * std::sin(theta);
+            if (currentLineLength >= settings.pixelFootprint) {
+                if (runLength > 0.0f) {
+                    flushRun(x, y);
+                }
+                onSegment(x, y, nextX, nextY, theta);
+            } else {
+                if (runLength == 0.0f) {
+                    runX = x;
+                    runY = y;
+                }
+                runLength += currentLineLength;
+                if (runLength >= settings.pixelFootprint) {
+                    flushRun(nextX, nextY);
+                }
+            }
+            x = nextX;
+            y = nextY;
+            if (settings.isLogarithmic) {
+                currentLineLength *= decay;
+            }
+            currentTheta = theta;
+        }
+        if (runLength > 0.0f) {
+            flushRun(x, y);
+        }
+    }
+
     /// @brief How coordinates are arranged in any given segment.
     static inline const std::vector<std::string> coordinateParameters = {"x1", "x2", "x3", "x4", "y1", "y2", "y3", "y4"};
 
     /// @brief Returns the range value in a given string.
+    /// @details Accepts "[start] [end]" or "[start] [end] [sample-size]".
     /// @param rangeStr The string holding the range value.
     /// @return A `Range` containing the start and end values of a given range.
     static Range getRange(const std::string &rangeStr);
 
+    /// @brief Returns the sample size in a given range string, if one is specified.
+    /// @details Used by the parent process to split "Random" mode samples across shards.
+    /// @param rangeStr The string holding the range value.
+    /// @param defaultSampleSize The value returned if the string holds no sample size.
+    /// @return The sample size to use for this range.
+    static uint32_t getSampleSize(const std::string &rangeStr, uint32_t defaultSampleSize);
+
+    /// @brief Returns the batch entry in a given string.
+    /// @details Accepts a range string, optionally followed by tab-separated "[setting]=[value]" overrides.
+    /// @param entryStr The string holding the batch entry.
+    /// @param config The configuration the overrides are applied to.
+    /// @return A `BatchEntry` with its range, sample size and configuration set.
+    static BatchEntry getBatchEntry(const std::string &entryStr, const Config &config);
+
     /// @brief Serializes the given information into a single string for IPC.
     /// @param coordinates the coordinates of the image.
     /// @param style The style, colors, etc. of the image.
@@ -212,6 +417,140 @@ public:
     static std::array<uint64_t, 2> getIntsFromRepr(const std::string &repr);
 };
 
+/// @brief A single entry of the `SequenceDatabase` for a given n.
+struct DatabaseRecord {
+
+    /// @brief The largest value reached in the hailstone sequence of n.
+    uint64_t maxExcursion;
+
+    /// @brief The first value in the hailstone sequence of n that is less than n. 0 for n < 2.
+    uint64_t firstMerge;
+
+    /// @brief The number of steps for n to reach 1.
+    uint32_t stoppingTime;
+
+    /// @brief The number of steps for n to reach `firstMerge`.
+    uint32_t mergeSteps;
+
+    /// @brief The number of odd steps (3n + 1) for n to reach 1.
+    uint32_t oddSteps;
+
+    /// @brief Unused, keeps records 8-byte aligned.
+    uint32_t reserved;
+};
+
+/// @brief The header at the start of a `SequenceDatabase` file.
+struct DatabaseHeader {
+
+    /// @brief Identifies the file as a sequence database.
+    std::array<char, 8> magic;
+
+    /// @brief The format version of the file.
+    uint32_t version;
+
+    /// @brief `sizeof(DatabaseRecord)` of the process that wrote the file.
+    uint32_t recordSize;
+
+    /// @brief The number of valid records. Records are stored for every n in [0, count).
+    uint64_t count;
+};
+
+/// @brief An on-disk, memory-mapped table of `DatabaseRecord`s indexed by n, reused across runs.
+/// @details Opening only maps the file, so startup does not depend on the database size.
+/// Records are extended incrementally, each new n only iterating until it drops below itself.
+class SequenceDatabase {
+private:
+
+    /// @brief Path to the database file.
+    fs::path path;
+
+    #ifdef _WIN32
+    /// @brief Handle to the database file.
+    HANDLE file = INVALID_HANDLE_VALUE;
+
+    /// @brief Handle to the file mapping of the database file.
+    HANDLE mapping = NULL;
+    #else
+    /// @brief File descriptor of the database file.
+    int file = -1;
+    #endif
+
+    /// @brief Start of the mapped view of the database file.
+    char *view = nullptr;
+
+    /// @brief Size of the mapped view in bytes.
+    size_t viewSize = 0;
+
+    /// @brief Holds an exclusive lock on the database file, shared by every process, for as long as it lives.
+    class FileLock {
+    private:
+
+        /// @brief The database whose file is locked.
+        const SequenceDatabase &database;
+    public:
+
+        /// @brief Default constructor. Blocks until the lock is acquired.
+        /// @param database The database whose file is to be locked.
+        explicit FileLock(const SequenceDatabase &database);
+
+        /// @brief Destructor. Releases the lock.
+        ~FileLock();
+
+        FileLock(const FileLock &) = delete;
+        FileLock &operator=(const FileLock &) = delete;
+    };
+
+    /// @brief Maps the first `size` bytes of the database file, growing the file if needed. Never shrinks it.
+    /// @details Must hold a `FileLock`, as another process may grow the file between checking its size and growing it.
+    /// @param size The size of the view in bytes.
+    void map(size_t size);
+
+    /// @brief Unmaps the current view, if any.
+    void unmap();
+
+    /// @brief Returns the header of the mapped database.
+    DatabaseHeader *header() const;
+
+    /// @brief Returns the first record of the mapped database.
+    DatabaseRecord *records() const;
+public:
+
+    /// @brief Identifies the file as a sequence database.
+    static constexpr std::array<char, 8> magic = {'H', 'A', 'I', 'L', 'S', 'T', 'D', 'B'};
+
+    /// @brief The current format version. Files with any other version are rebuilt.
+    static constexpr uint32_t version = 2;
+
+    /// @brief The fewest records computed in parallel at once by `extend`.
+    static constexpr uint64_t minimumBlockSize = 1 << 16;
+
+    /// @brief The number of records each thread takes at a time within a block.
+    static constexpr size_t recordChunkSize = 4096;
+
+    /// @brief Default constructor. Opens the database, creating or rebuilding it if it is missing or incompatible.
+    /// @param path Path to the database file.
+    SequenceDatabase(const fs::path &path);
+
+    /// @brief Destructor. Flushes and unmaps the database.
+    ~SequenceDatabase();
+
+    SequenceDatabase(const SequenceDatabase &) = delete;
+    SequenceDatabase &operator=(const SequenceDatabase &) = delete;
+
+    /// @brief Returns the number of records held. Records are held for every n in [0, size()).
+    uint64_t size() const;
+
+    /// @brief Returns the record for a given n.
+    /// @param n The value to look up.
+    /// @return A pointer into the mapped file, or `nullptr` if n is not held.
+    const DatabaseRecord *get(uint64_t n) const;
+
+    /// @brief Computes the records for all n up to and including `bound` that are not held yet, in parallel blocks.
+    /// @details Holds a `FileLock` throughout, so processes sharing the file never compute the same records twice.
+    /// @param bound The largest n to be held.
+    void extend(uint64_t bound);
+};
+
 /// @brief Class that holds methods for IPC between the main Python process and this C++ subprocess.
 class IPC {
 private:
@@ -232,6 +571,10 @@ public:
         {"procFnsh", "/2"},
         {"sendData", "/3"},
         {"terminate", "/-1"},
+        {"batch", "/4"},
+        {"batchFrame", "/5"},
+        {"batchError", "/6"},
+        {"analytics", "/7"},
     };
 
     
@@ -253,6 +596,9 @@ private:
 
     /// @brief Holds the configuration information as string key-value pairs.
     std::unordered_map<std::string, std::string> config;
+
+    /// @brief `std::unique_ptr` to the persistent sequence database. `nullptr` if disabled.
+    std::unique_ptr<SequenceDatabase> database = nullptr;
 public:
 
     /// @brief Default constructor
@@ -262,10 +608,35 @@ public:
     /// @brief Main entry point. Starts the subprocess.
     void start();
 
+    /// @brief Evaluates the hailstone sequences of the values in a range, then renders them.
+    /// @param range The range to evaluate.
+    /// @param sampleSize The number of values to sample in "Random" mode.
+    /// @return The serialized image data, according to "render-mode".
+    std::string renderSequences(const Range &range, uint32_t sampleSize);
+
+    /// @brief Receives the entries of a batch request, then renders all of them from shared sequences.
+    /// @details The union of the values of all entries is evaluated once. Each entry is then rendered in turn with every thread,
+    /// and sent as soon as it is done as "/5 [index] [size]" followed by its data, or "/6 [index] [error]" if it failed.
+    /// @param entryCount The number of entries to receive.
+    void renderBatch(size_t entryCount);
+
+    /// @brief Renders a single batch entry.
+    /// @param entry The entry to render.
+    /// @param sequences The batch's shared sequences, which `entry.indices` refer to.
+    /// @return The serialized image data, according to the entry's "render-mode".
+    std::string renderBatchEntry(const BatchEntry &entry, const std::vector<std::vector<uint64_t>> &sequences);
+
+    /// @brief Grows the inverse Collatz tree from 1 up to "tree-depth" steps, then renders it.
+    /// @param range The range requested. Its end caps the values of the nodes.
+    /// @return The serialized image data, according to "render-mode".
+    std::string renderInverseTree(const Range &range);
+
     /// @brief Gets the values to be evaluated based on configuration and range.
     /// @param range The range to evaluate.
+    /// @param sampleSize The number of values to sample in "Random" mode.
+    /// @param config The configuration to evaluate with.
     /// @return A vector of values to be evaluated based on configuration and range.
-    std::vector<uint32_t> getValues(const Range &range);
+    std::vector<uint32_t> getValues(const Range &range, uint32_t sampleSize, const Config &config);
 
     /// @brief Gives the hailstone sequences associated with the values passed in.
     /// @param values The values to evaluate.
@@ -277,15 +648,77 @@ public:
     /// @return A vector containing the hailstone sequence for n.
     std::vector<uint64_t> getSequence(uint32_t n);
 
-    /// @brief Returns the coordinates based on the sequence and configuration that serve as vertices in the final image for all sequences.
-    /// @param sequences The hailstone sequences to be evaluated.
+    /// @brief Returns the coordinates of every segment from a `SegmentSource`, in no particular order.
+    /// @param source The segments to be evaluated.
+    /// @param config The configuration to evaluate with.
     /// @return A map of coordinates with each ith index of a vector being a value for a coordinate of the ith segment.
-    std::unordered_map<std::string, std::vector<F32>> getCoordinates(const std::vector<std::vector<uint64_t>> &sequences);
+    std::unordered_map<std::string, std::vector<F32>> getCoordinates(const SegmentSource &source, const Config &config);
+
+    /// @brief Gets the trajectory statistics of a given n without storing its sequence.
+    /// @details Iterates until the sequence reaches 1, or a value held by the database.
+    /// @param n The value to evaluate.
+    /// @return The `TrajectoryStats` of n.
+    TrajectoryStats getTrajectoryStats(uint64_t n);
+
+    /// @brief Computes per-n trajectory statistics for a range in parallel, without storing any sequence.
+    /// @details Covers the same values as "Continuous" mode. Layout, all little-endian `uint64_t` unless noted:
+    /// [Start] [Count] [Count x Max value] [Count x Stopping time (uint32)] [Count x Odd steps (uint32)]
+    /// [H] [H x Stopping time histogram] [H2] [H2 x Odd step histogram]
+    /// [R] [R x n] [R x Stopping time] (stopping time record holders, in order)
+    /// [R2] [R2 x n] [R2 x Max value] (max value record holders, in order).
+    /// @param range The range to evaluate.
+    /// @return The serialized columns, histograms and record holders.
+    std::string getAnalytics(const Range &range);
+
+    /// @brief Returns the geometry settings from a configuration.
+    /// @details `pixelFootprint` is always 0, as it depends on the segments to be drawn.
+    /// @param config The configuration to read from.
+    GeometrySettings getGeometrySettings(const Config &config);
+
+    /// @brief Returns the bounding box of the centerlines of every segment from a `SegmentSource`.
+    /// @param source The segments to be evaluated. Every segment is assumed to be connected to the origin.
+    BoundingBox getBoundingBox(const SegmentSource &source);
+
+    /// @brief Returns the length of one pixel of the final image, in the units of the coordinates.
+    /// @details The bounding box is mapped to "image-size" the same way as the parent process.
+    /// Merging segments never moves the bounding box, so the box of the unmerged segments can be passed.
+    /// @param box The bounding box of the segments to be drawn.
+    /// @param config The configuration to evaluate with.
+    /// @return The pixel footprint, or 0 if "level-of-detail" is "Off".
+    F32 getPixelFootprint(const BoundingBox &box, const Config &config);
+
+    /// @brief Returns a `SegmentSource` tracing the centerlines of the given sequences.
+    /// @param sequences The hailstone sequences. Must outlive the source.
+    /// @param indices The indices of the sequences to be traced. Must outlive the source.
+    /// @param config The configuration to trace with.
+    /// @param pixelFootprint Consecutive shorter segments are merged, see `SubprocessUtilities::traceSequence`. 0 to disable.
+    SegmentSource getSequenceSource(
+        const std::vector<std::vector<uint64_t>> &sequences, const std::vector<size_t> &indices, const Config &config,
+        F32 pixelFootprint = 0.0f
+    );
 
-    /// @brief Returns the `RGBA` color values for each segment depending on the configuration.
-    /// @param sequences The hailstone sequences whose colors are to be evaluated.
+    /// @brief Returns a `SegmentSource` growing the inverse Collatz tree breadth-first from 1.
+    /// @details Children of m are 2m, and (m - 1) / 3 when it is an odd integer greater than 1.
+    /// Each frontier level is expanded in parallel, each node drawn from its parent's position and heading,
+    /// so every node is computed exactly once and only the current frontier is held.
+    /// @param depth The maximum number of steps from 1.
+    /// @param valueCap Nodes with greater values are neither drawn nor expanded. 0 for no cap.
+    /// @param config The configuration to trace with.
+    SegmentSource getInverseTreeSource(uint32_t depth, uint64_t valueCap, const Config &config);
+
+    /// @brief Rasterizes the centerlines of all segments into a hit-count grid, then tone maps it through the gradient.
+    /// @details Each thread accumulates into its own `uint32_t` grid sized to "image-size", the grids are then summed.
+    /// @param source The segments to be rasterized.
+    /// @param box The bounding box of the centerlines of `source`, see `getBoundingBox`.
+    /// @param config The configuration to rasterize with.
+    /// @return The serialized final image: [Width (uint32)] [Height (uint32)] [Background RGBA] [Width * Height RGBA pixels, top row first].
+    std::string getDensityImage(const SegmentSource &source, const BoundingBox &box, const Config &config);
+
+    /// @brief Returns the `RGBA` color values for a number of segments depending on the configuration.
+    /// @param segmentCount The number of segments.
+    /// @param config The configuration to evaluate with.
     /// @return A map containing each channel as a string with the ith index of the vector being the ith segment's channel value for that color.
-    std::unordered_map<std::string, std::vector<uint8_t>> getStyles(const std::vector<std::vector<uint64_t>> &sequences);
+    std::unordered_map<std::string, std::vector<uint8_t>> getStyles(size_t segmentCount, const Config &config);
 
     /// @brief Exits the process and terminates it gracefully.
     void quit();
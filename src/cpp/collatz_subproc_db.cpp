@@ -0,0 +1,226 @@
+#include "collatz_subproc_header.hpp"
+
+SequenceDatabase::SequenceDatabase(const fs::path &path) : path(path) {
+    #ifdef _WIN32
+    file = CreateFileW(
+        path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Database file cannot be opened.");
+    }
+    #else
+    file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (file == -1) {
+        throw std::runtime_error("Database file cannot be opened.");
+    }
+    #endif
+
+    // Another process may be creating or rebuilding the same file.
+    const FileLock lock(*this);
+    #ifdef _WIN32
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(file, &fileSize)) {
+        throw std::runtime_error("Database file size cannot be retrieved.");
+    }
+    const size_t existingSize = static_cast<size_t>(fileSize.QuadPart);
+    #else
+    struct stat fileStat = {};
+    if (fstat(file, &fileStat) == -1) {
+        throw std::runtime_error("Database file size cannot be retrieved.");
+    }
+    const size_t existingSize = static_cast<size_t>(fileStat.st_size);
+    #endif
+
+    // Only the header is validated, records are paged in lazily as they are read.
+    if (existingSize >= sizeof(DatabaseHeader)) {
+        map(existingSize);
+        const DatabaseHeader *existing = header();
+        const size_t expectedSize = sizeof(DatabaseHeader) + existing->count * sizeof(DatabaseRecord);
+        if (
+            existing->magic == magic && existing->version == version &&
+            existing->recordSize == sizeof(DatabaseRecord) && expectedSize <= existingSize
+        ) {
+            return;
+        }
+    }
+
+    // Missing or incompatible, start over with an empty database.
+    map(sizeof(DatabaseHeader));
+    DatabaseHeader *fresh = header();
+    fresh->magic = magic;
+    fresh->version = version;
+    fresh->recordSize = sizeof(DatabaseRecord);
+    fresh->count = 0;
+}
+
+SequenceDatabase::~SequenceDatabase() {
+    unmap();
+    #ifdef _WIN32
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+    #else
+    if (file != -1) {
+        close(file);
+    }
+    #endif
+}
+
+SequenceDatabase::FileLock::FileLock(const SequenceDatabase &database) : database(database) {
+    #ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    if (!LockFileEx(database.file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped)) {
+        throw std::runtime_error("Database file cannot be locked.");
+    }
+    #else
+    while (flock(database.file, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            throw std::runtime_error("Database file cannot be locked.");
+        }
+    }
+    #endif
+}
+
+SequenceDatabase::FileLock::~FileLock() {
+    #ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    UnlockFileEx(database.file, 0, 1, 0, &overlapped);
+    #else
+    flock(database.file, LOCK_UN);
+    #endif
+}
+
+void SequenceDatabase::map(size_t size) {
+    unmap();
+    #ifdef _WIN32
+    const uint64_t size64 = static_cast<uint64_t>(size);
+    mapping = CreateFileMappingW(
+        file, NULL, PAGE_READWRITE,
+        static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64 & 0xFFFFFFFF), NULL
+    );
+    if (mapping == NULL) {
+        throw std::runtime_error("Database file cannot be mapped.");
+    }
+    view = static_cast<char *>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (view == nullptr) {
+        throw std::runtime_error("Database file cannot be mapped.");
+    }
+    #else
+    struct stat fileStat = {};
+    if (fstat(file, &fileStat) == -1) {
+        throw std::runtime_error("Database file size cannot be retrieved.");
+    }
+    // Shrinking the file would fault the views of other processes.
+    if (static_cast<size_t>(fileStat.st_size) < size && ftruncate(file, static_cast<off_t>(size)) == -1) {
+        throw std::runtime_error("Database file cannot be resized.");
+    }
+    void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Database file cannot be mapped.");
+    }
+    view = static_cast<char *>(mapped);
+    #endif
+    viewSize = size;
+}
+
+void SequenceDatabase::unmap() {
+    if (view == nullptr) {
+        return;
+    }
+    #ifdef _WIN32
+    FlushViewOfFile(view, 0);
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+    mapping = NULL;
+    #else
+    msync(view, viewSize, MS_ASYNC);
+    munmap(view, viewSize);
+    #endif
+    view = nullptr;
+    viewSize = 0;
+}
+
+DatabaseHeader *SequenceDatabase::header() const {
+    return reinterpret_cast<DatabaseHeader *>(view);
+}
+
+DatabaseRecord *SequenceDatabase::records() const {
+    return reinterpret_cast<DatabaseRecord *>(view + sizeof(DatabaseHeader));
+}
+
+uint64_t SequenceDatabase::size() const {
+    // Another process may have published more records than this view covers.
+    const uint64_t mappedCount = (viewSize - sizeof(DatabaseHeader)) / sizeof(DatabaseRecord);
+    const uint64_t count = std::atomic_ref<uint64_t>(header()->count).load(std::memory_order_acquire);
+    return std::min(count, mappedCount);
+}
+
+const DatabaseRecord *SequenceDatabase::get(uint64_t n) const {
+    if (n >= size()) {
+        return nullptr;
+    }
+    return &records()[n];
+}
+
+void SequenceDatabase::extend(uint64_t bound) {
+    const uint64_t end = bound + 1;
+    if (end <= size()) {
+        return;
+    }
+
+    // Another process may have extended the file while this one waited for the lock.
+    const FileLock lock(*this);
+    map(std::max(viewSize, sizeof(DatabaseHeader) + end * sizeof(DatabaseRecord)));
+    const uint64_t start = size();
+    if (end <= start) {
+        return;
+    }
+    DatabaseRecord *table = records();
+    for (uint64_t n = start; n < std::min<uint64_t>(end, 2); ++n) {
+        table[n] = {n, 0, 0, 0, 0, 0};
+    }
+    if (start < 2) {
+        std::atomic_ref<uint64_t>(header()->count).store(std::min<uint64_t>(end, 2), std::memory_order_release);
+    }
+
+    // Each n iterates until it drops below its block rather than below itself, so it only relies on records
+    // already held and every record in a block can be computed in parallel. Doubling blocks keep the extra steps few.
+    uint64_t blockStart = std::max<uint64_t>(start, 2);
+    while (blockStart < end) {
+        const uint64_t blockEnd = std::min(end, std::max(blockStart * 2, blockStart + minimumBlockSize));
+        ThreadUtilities::parallelFor(blockEnd - blockStart, recordChunkSize, [&](size_t, size_t begin, size_t last) {
+            for (uint64_t n = blockStart + begin; n < blockStart + last; ++n) {
+                uint64_t currentN = n;
+                uint64_t maxExcursion = n;
+                uint64_t firstMerge = 0;
+                uint32_t steps = 0;
+                uint32_t mergeSteps = 0;
+                uint32_t oddSteps = 0;
+                while (currentN >= blockStart) {
+                    if ((currentN & 0b1) == 0b1) {
+                        currentN = currentN * 3 + 1;
+                        ++oddSteps;
+                    } else {
+                        currentN /= 2;
+                    }
+                    maxExcursion = std::max(maxExcursion, currentN);
+                    ++steps;
+                    if (firstMerge == 0 && currentN < n) {
+                        firstMerge = currentN;
+                        mergeSteps = steps;
+                    }
+                }
+                const DatabaseRecord &held = table[currentN];
+                table[n] = {
+                    std::max(maxExcursion, held.maxExcursion), firstMerge,
+                    steps + held.stoppingTime, mergeSteps, oddSteps + held.oddSteps, 0
+                };
+            }
+        });
+
+        // Published after every block, so an interrupted extension leaves the previous records valid.
+        std::atomic_ref<uint64_t>(header()->count).store(blockEnd, std::memory_order_release);
+        blockStart = blockEnd;
+    }
+}
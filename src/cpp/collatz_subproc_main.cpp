@@ -18,6 +18,11 @@ void Subprocess::start() {
     fs::path configPath = ConfigUtilities::getExecutablePath().parent_path() / "config.yaml";
     config = ConfigUtilities::getConfig(configPath);
     std::stringstream ss;
+    if (ConfigUtilities::getValue(config.at("database-bound")) > 0) {
+        database = std::make_unique<SequenceDatabase>(
+            ConfigUtilities::getExecutablePath().parent_path() / "collatz_database.bin"
+        );
+    }
 
     while (true) {
         const std::string input = ipc->receive();
@@ -26,37 +31,24 @@ void Subprocess::start() {
         } else if (input == ipc->codes.at("test")) {
             ipc->send(ipc->codes.at("testSuc"), false);
             continue;
+        } else if (input.starts_with(ipc->codes.at("batch") + " ")) {
+            renderBatch(ConfigUtilities::getValue(input.substr(ipc->codes.at("batch").size() + 1)));
+            continue;
         }
-        const Range range = SubprocessUtilities::getRange(input);
-
-        ipc->send("Setting values...\n", false);
-        const std::vector<uint32_t> values = getValues(range);
-
-        ss << "Values set.\nNo. of sequences to evaluate: " << values.size() << "\n";
-        ipc->send(ss.str(), false);
-        ss.str("");
-        ipc->send("Evaluating sequences...", false);
-        const std::vector<std::vector<uint64_t>> sequences = getSequences(values);
-
-        size_t seg_size = 0;
-        for (std::vector<uint64_t> seq : sequences) {
-            seg_size += seq.size() - 1; 
-        }
-        ss << "Sequences evaluated.\nNo. of coordinates to set: " << seg_size * 8 << " values.\n";
-        ipc->send(ss.str(), false);
-        ss.str("");
-        ipc->send("Evaluating coordinates...", false);
-        const std::unordered_map<std::string, std::vector<float>> coordinates = getCoordinates(sequences);
-        
-
-        ipc->send("Getting styles...", false);
-        const std::unordered_map<std::string, std::vector<uint8_t>> styles = getStyles(sequences);
-
-        ipc->send("Assembling values...", false);
-        const std::string imageData = SubprocessUtilities::assembleValues(
-            coordinates, styles, 
-            ConfigUtilities::getRGBA(config.at("background-color"))
+        const bool isAnalytics = input.starts_with(ipc->codes.at("analytics") + " ");
+        const std::string request = isAnalytics ? input.substr(ipc->codes.at("analytics").size() + 1) : input;
+        const Range range = SubprocessUtilities::getRange(request);
+        const uint32_t sampleSize = SubprocessUtilities::getSampleSize(
+            request, ConfigUtilities::getValue(config.at("sample-size"))
         );
+        std::string imageData = "";
+        if (isAnalytics) {
+            imageData = getAnalytics(range);
+        } else if (config.at("generation") == "Inverse-tree") {
+            imageData = renderInverseTree(range);
+        } else {
+            imageData = renderSequences(range, sampleSize);
+        }
 
         ss << ipc->codes.at("procFnsh") << imageData.size();
         ipc->send(ss.str(), false);
@@ -70,14 +62,178 @@ void Subprocess::start() {
         ss.str("");
     }
 }
-std::vector<uint32_t> Subprocess::getValues(const Range &range) {
+
+std::string Subprocess::renderSequences(const Range &range, uint32_t sampleSize) {
+    std::stringstream ss;
+    ipc->send("Setting values...\n", false);
+    const std::vector<uint32_t> values = getValues(range, sampleSize, config);
+
+    ss << "Values set.\nNo. of sequences to evaluate: " << values.size() << "\n";
+    ipc->send(ss.str(), false);
+    ss.str("");
+    ipc->send("Evaluating sequences...", false);
+    const std::vector<std::vector<uint64_t>> sequences = getSequences(values);
+
+    size_t seg_size = 0;
+    for (std::vector<uint64_t> seq : sequences) {
+        seg_size += seq.size() - 1; 
+    }
+    ss << "Sequences evaluated.\nNo. of coordinates to set: " << seg_size * 8 << " values.\n";
+    ipc->send(ss.str(), false);
+    ss.str("");
+    const bool isDensity = config.at("render-mode") == "Density";
+    std::vector<size_t> indices(sequences.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    SegmentSource source = getSequenceSource(sequences, indices, config);
+
+    // The bounding box is only traced if density or the pixel footprint need it, then shared by both.
+    BoundingBox box = {0.0f, 0.0f, 0.0f, 0.0f};
+    if (isDensity || config.at("level-of-detail") == "Merge") {
+        box = getBoundingBox(source);
+        source = getSequenceSource(sequences, indices, config, getPixelFootprint(box, config));
+    }
+    if (isDensity) {
+        ipc->send("Rasterizing density...", false);
+        return getDensityImage(source, box, config);
+    }
+    ipc->send("Evaluating coordinates...", false);
+    const std::unordered_map<std::string, std::vector<float>> coordinates = getCoordinates(source, config);
+    ss << "Coordinates evaluated.\nNo. of segments after level of detail: " << coordinates.at("x1").size() << "\n";
+    ipc->send(ss.str(), false);
+    ss.str("");
+
+    ipc->send("Getting styles...", false);
+    const std::unordered_map<std::string, std::vector<uint8_t>> styles = getStyles(coordinates.at("x1").size(), config);
+
+    ipc->send("Assembling values...", false);
+    return SubprocessUtilities::assembleValues(
+        coordinates, styles, 
+        ConfigUtilities::getRGBA(config.at("background-color"))
+    );
+}
+
+void Subprocess::renderBatch(size_t entryCount) {
+    std::stringstream ss;
+    std::vector<BatchEntry> entries(entryCount);
+    for (size_t i = 0; i < entryCount; ++i) {
+        const std::string entryStr = ipc->receive();
+        try {
+            entries[i] = SubprocessUtilities::getBatchEntry(entryStr, config);
+        } catch (const std::exception &e) {
+            entries[i].error = e.what();
+        }
+    }
+
+    // Union of the values of every forward entry, each entry keeping the indices of its own values.
+    std::vector<std::vector<uint32_t>> entryValues(entryCount);
+    std::vector<uint32_t> values = {};
+    size_t requestedCount = 0;
+    for (size_t i = 0; i < entryCount; ++i) {
+        const BatchEntry &entry = entries[i];
+        if (!entry.error.empty() || entry.config.at("generation") == "Inverse-tree") {
+            continue;
+        }
+        entryValues[i] = getValues(entry.range, entry.sampleSize, entry.config);
+        requestedCount += entryValues[i].size();
+        values.insert(values.end(), entryValues[i].begin(), entryValues[i].end());
+    }
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    for (size_t i = 0; i < entryCount; ++i) {
+        std::vector<size_t> &indices = entries[i].indices;
+        indices.reserve(entryValues[i].size());
+        for (const uint32_t value : entryValues[i]) {
+            indices.push_back(std::lower_bound(values.begin(), values.end(), value) - values.begin());
+        }
+    }
+    entryValues.clear();
+
+    ss << "Batch of " << entryCount << " entries.\nNo. of sequences to evaluate: " << values.size()
+       << " (" << requestedCount << " requested).\n";
+    ipc->send(ss.str(), false);
+    ss.str("");
+    ipc->send("Evaluating sequences...", false);
+    const std::vector<std::vector<uint64_t>> sequences = getSequences(values);
+    ipc->send("Sequences evaluated.\nRendering entries...", false);
+
+    // Entries are rendered one after another, each sent as soon as it is done.
+    // Rendering an entry is already parallel, running entries side by side would leave each on a single thread.
+    for (size_t i = 0; i < entryCount; ++i) {
+        std::string error = entries[i].error;
+        std::string imageData = "";
+        if (error.empty()) {
+            try {
+                imageData = renderBatchEntry(entries[i], sequences);
+            } catch (const std::exception &e) {
+                error = e.what();
+            }
+        }
+        std::stringstream frame;
+        if (!error.empty()) {
+            frame << ipc->codes.at("batchError") << " " << i << " " << error;
+            ipc->send(frame.str(), false);
+            continue;
+        }
+        frame << ipc->codes.at("batchFrame") << " " << i << " " << imageData.size();
+        ipc->send(frame.str(), false);
+        ipc->send(imageData, true);
+    }
+}
+
+std::string Subprocess::renderBatchEntry(const BatchEntry &entry, const std::vector<std::vector<uint64_t>> &sequences) {
+    const Config &entryConfig = entry.config;
+    const bool isDensity = entryConfig.at("render-mode") == "Density";
+    const bool isTree = entryConfig.at("generation") == "Inverse-tree";
+    SegmentSource source = isTree ?
+        getInverseTreeSource(ConfigUtilities::getValue(entryConfig.at("tree-depth")), entry.range.second, entryConfig) :
+        getSequenceSource(sequences, entry.indices, entryConfig);
+
+    // Same as `renderSequences`, the inverse tree is never merged.
+    BoundingBox box = {0.0f, 0.0f, 0.0f, 0.0f};
+    if (isDensity || (!isTree && entryConfig.at("level-of-detail") == "Merge")) {
+        box = getBoundingBox(source);
+    }
+    if (!isTree) {
+        source = getSequenceSource(sequences, entry.indices, entryConfig, getPixelFootprint(box, entryConfig));
+    }
+    if (isDensity) {
+        return getDensityImage(source, box, entryConfig);
+    }
+    const std::unordered_map<std::string, std::vector<float>> coordinates = getCoordinates(source, entryConfig);
+    const std::unordered_map<std::string, std::vector<uint8_t>> styles = getStyles(coordinates.at("x1").size(), entryConfig);
+    return SubprocessUtilities::assembleValues(
+        coordinates, styles,
+        ConfigUtilities::getRGBA(entryConfig.at("background-color"))
+    );
+}
+
+std::string Subprocess::renderInverseTree(const Range &range) {
+    static const uint32_t depth = ConfigUtilities::getValue(config.at("tree-depth"));
+    const SegmentSource source = getInverseTreeSource(depth, range.second, config);
+    if (config.at("render-mode") == "Density") {
+        ipc->send("Growing inverse tree and rasterizing density...", false);
+        return getDensityImage(source, getBoundingBox(source), config);
+    }
+    ipc->send("Growing inverse tree...", false);
+    const std::unordered_map<std::string, std::vector<float>> coordinates = getCoordinates(source, config);
+
+    ipc->send("Getting styles...", false);
+    const std::unordered_map<std::string, std::vector<uint8_t>> styles = getStyles(coordinates.at("x1").size(), config);
+
+    ipc->send("Assembling values...", false);
+    return SubprocessUtilities::assembleValues(
+        coordinates, styles,
+        ConfigUtilities::getRGBA(config.at("background-color"))
+    );
+}
+
+std::vector<uint32_t> Subprocess::getValues(const Range &range, uint32_t sampleSize, const Config &config) {
     if (range.first == range.second) {
         std::vector<uint32_t> singleValue = {range.first};
         return singleValue;
     }
-    static const std::string mode = config.at("mode");
+    const std::string mode = config.at("mode");
     const size_t effectiveRange = static_cast<size_t>(range.second - range.first);
-    const uint32_t sampleSize = ConfigUtilities::getValue(config.at("sample-size"));
     if (mode == "Continuous" || effectiveRange < sampleSize) {
         std::vector<uint32_t> values(effectiveRange);
         for (size_t i = 0; i < effectiveRange; ++i) {
@@ -96,17 +252,27 @@ std::vector<uint32_t> Subprocess::getValues(const Range &range) {
     }
 }
 std::vector<std::vector<uint64_t>> Subprocess::getSequences(const std::vector<uint32_t> &values) {
+    static const size_t valueChunkSize = 256;
     const size_t valueCount = values.size();
     std::vector<std::vector<uint64_t>> sequences(valueCount);
-    for (size_t i = 0; i < valueCount; ++i) {
-        sequences[i] = getSequence(values[i]);
-    }
+    ThreadUtilities::parallelFor(valueCount, valueChunkSize, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            sequences[i] = getSequence(values[i]);
+        }
+    });
     return sequences;
 }
 
 std::vector<uint64_t> Subprocess::getSequence(uint32_t n) {
     uint64_t currentN = n;
     std::vector<uint64_t> sequence = {currentN};
+
+    // Drawing needs every value, so records already held only size the sequence. Rendering never extends them.
+    if (database) {
+        if (const DatabaseRecord *record = database->get(n)) {
+            sequence.reserve(record->stoppingTime + 1);
+        }
+    }
     while (currentN != 1) {
         if (currentN & 0b1 == 0b1) {
             currentN = currentN * 3 + 1;
@@ -118,75 +284,403 @@ std::vector<uint64_t> Subprocess::getSequence(uint32_t n) {
     return sequence;
 }
 
-std::unordered_map<std::string, std::vector<F32>> Subprocess::getCoordinates(const std::vector<std::vector<uint64_t>> &sequences) {
-    static const std::string scaling = config.at("scaling");
-    static const uint8_t lineLength = static_cast<uint8_t>(ConfigUtilities::getValue(config.at("line-length")));
-    static const uint8_t lineWidth = static_cast<uint8_t>(ConfigUtilities::getValue(config.at("line-width")));
+TrajectoryStats Subprocess::getTrajectoryStats(uint64_t n) {
+    uint64_t currentN = n;
+    TrajectoryStats stats = {n, 0, 0};
+    while (currentN != 1) {
+        if (database) {
+            if (const DatabaseRecord *record = database->get(currentN)) {
+                stats.maxValue = std::max(stats.maxValue, record->maxExcursion);
+                stats.stoppingTime += record->stoppingTime;
+                stats.oddSteps += record->oddSteps;
+                return stats;
+            }
+        }
+        if ((currentN & 0b1) == 0b1) {
+            currentN = currentN * 3 + 1;
+            ++stats.oddSteps;
+        } else {
+            currentN /= 2;
+        }
+        stats.maxValue = std::max(stats.maxValue, currentN);
+        ++stats.stoppingTime;
+    }
+    return stats;
+}
+
+std::string Subprocess::getAnalytics(const Range &range) {
+    static const uint32_t databaseBound = ConfigUtilities::getValue(config.at("database-bound"));
+    static const size_t valueChunkSize = 4096;
+    static const size_t tailReserve = 1 << 20;
+    const uint64_t start = range.first;
+    const uint64_t count = range.first == range.second ? 1 : range.second - range.first;
+    std::stringstream ss;
+    if (database && database->size() <= std::min(databaseBound, range.second)) {
+        ipc->send("Extending database...", false);
+        database->extend(std::min(databaseBound, range.second));
+    }
+    ss << "No. of values to evaluate: " << count << "\nEvaluating trajectory statistics...";
+    ipc->send(ss.str(), false);
+    ss.str("");
+
+    // Columns are written in place into the payload, the tail is reserved for the histograms and records.
+    const size_t columnBytes = sizeof(uint64_t) * 2 + count * (sizeof(uint64_t) + sizeof(uint32_t) * 2);
+    std::string payload = "";
+    payload.reserve(columnBytes + tailReserve);
+    payload.resize(columnBytes, '\0');
+    char *bufferPtr = payload.data();
+    std::memcpy(bufferPtr, &start, sizeof(uint64_t));
+    std::memcpy(bufferPtr + sizeof(uint64_t), &count, sizeof(uint64_t));
+    uint64_t *maxValues = reinterpret_cast<uint64_t *>(bufferPtr + sizeof(uint64_t) * 2);
+    uint32_t *stoppingTimes = reinterpret_cast<uint32_t *>(maxValues + count);
+    uint32_t *oddSteps = stoppingTimes + count;
+
+    // Per-thread histograms, and per-chunk maxima so record holders are only searched for where they can be.
+    const size_t threadCount = ThreadUtilities::getThreadCount();
+    const size_t chunkCount = (count + valueChunkSize - 1) / valueChunkSize;
+    std::vector<std::vector<uint64_t>> stoppingTimeHistograms(threadCount);
+    std::vector<std::vector<uint64_t>> oddStepHistograms(threadCount);
+    std::vector<uint32_t> chunkMaxStoppingTimes(chunkCount, 0);
+    std::vector<uint64_t> chunkMaxValues(chunkCount, 0);
+    ThreadUtilities::parallelFor(count, valueChunkSize, [&](size_t thread, size_t begin, size_t end) {
+        std::vector<uint64_t> &stoppingTimeHistogram = stoppingTimeHistograms[thread];
+        std::vector<uint64_t> &oddStepHistogram = oddStepHistograms[thread];
+        uint32_t chunkMaxStoppingTime = 0;
+        uint64_t chunkMaxValue = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const TrajectoryStats stats = getTrajectoryStats(start + i);
+            maxValues[i] = stats.maxValue;
+            stoppingTimes[i] = stats.stoppingTime;
+            oddSteps[i] = stats.oddSteps;
+            if (stoppingTimeHistogram.size() <= stats.stoppingTime) {
+                stoppingTimeHistogram.resize(stats.stoppingTime + 1, 0);
+            }
+            if (oddStepHistogram.size() <= stats.oddSteps) {
+                oddStepHistogram.resize(stats.oddSteps + 1, 0);
+            }
+            ++stoppingTimeHistogram[stats.stoppingTime];
+            ++oddStepHistogram[stats.oddSteps];
+            chunkMaxStoppingTime = std::max(chunkMaxStoppingTime, stats.stoppingTime);
+            chunkMaxValue = std::max(chunkMaxValue, stats.maxValue);
+        }
+        chunkMaxStoppingTimes[begin / valueChunkSize] = chunkMaxStoppingTime;
+        chunkMaxValues[begin / valueChunkSize] = chunkMaxValue;
+    });
+
+    ipc->send("Aggregating statistics...", false);
+    const auto mergeHistograms = [](const std::vector<std::vector<uint64_t>> &threadHistograms) {
+        std::vector<uint64_t> histogram = {};
+        for (const std::vector<uint64_t> &threadHistogram : threadHistograms) {
+            if (histogram.size() < threadHistogram.size()) {
+                histogram.resize(threadHistogram.size(), 0);
+            }
+            for (size_t i = 0; i < threadHistogram.size(); ++i) {
+                histogram[i] += threadHistogram[i];
+            }
+        }
+        return histogram;
+    };
+    const std::vector<uint64_t> stoppingTimeHistogram = mergeHistograms(stoppingTimeHistograms);
+    const std::vector<uint64_t> oddStepHistogram = mergeHistograms(oddStepHistograms);
+
+    // Record holders: every n whose value exceeds that of all n before it in the range.
+    std::vector<uint64_t> stoppingTimeRecordValues = {};
+    std::vector<uint64_t> stoppingTimeRecordHolders = {};
+    std::vector<uint64_t> maxValueRecordValues = {};
+    std::vector<uint64_t> maxValueRecordHolders = {};
+    uint64_t bestStoppingTime = 0;
+    uint64_t bestValue = 0;
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        const size_t begin = chunk * valueChunkSize;
+        const size_t end = std::min(count, begin + valueChunkSize);
+        if (chunkMaxStoppingTimes[chunk] > bestStoppingTime) {
+            for (size_t i = begin; i < end; ++i) {
+                if (stoppingTimes[i] > bestStoppingTime) {
+                    bestStoppingTime = stoppingTimes[i];
+                    stoppingTimeRecordHolders.push_back(start + i);
+                    stoppingTimeRecordValues.push_back(stoppingTimes[i]);
+                }
+            }
+        }
+        if (chunkMaxValues[chunk] > bestValue) {
+            for (size_t i = begin; i < end; ++i) {
+                if (maxValues[i] > bestValue) {
+                    bestValue = maxValues[i];
+                    maxValueRecordHolders.push_back(start + i);
+                    maxValueRecordValues.push_back(maxValues[i]);
+                }
+            }
+        }
+    }
+
+    const auto appendColumn = [&payload](const std::vector<uint64_t> &column) {
+        payload.append(reinterpret_cast<const char *>(column.data()), column.size() * sizeof(uint64_t));
+    };
+    const auto appendSize = [&payload](uint64_t size) {
+        payload.append(reinterpret_cast<const char *>(&size), sizeof(uint64_t));
+    };
+    appendSize(stoppingTimeHistogram.size());
+    appendColumn(stoppingTimeHistogram);
+    appendSize(oddStepHistogram.size());
+    appendColumn(oddStepHistogram);
+    appendSize(stoppingTimeRecordHolders.size());
+    appendColumn(stoppingTimeRecordHolders);
+    appendColumn(stoppingTimeRecordValues);
+    appendSize(maxValueRecordHolders.size());
+    appendColumn(maxValueRecordHolders);
+    appendColumn(maxValueRecordValues);
+    return payload;
+}
+
+GeometrySettings Subprocess::getGeometrySettings(const Config &config) {
+    const GeometrySettings settings = {
+        static_cast<F32>(ConfigUtilities::getValue(config.at("line-length"))),
+        static_cast<F32>(ConfigUtilities::getValue(config.at("line-width"))),
+        MathUtilities::getRadians(ConfigUtilities::getFloatValue(config.at("angle-if-odd"))),
+        MathUtilities::getRadians(ConfigUtilities::getFloatValue(config.at("angle-if-even"))),
+        config.at("scaling") == "Logarithmic",
+        0.0f
+    };
+    return settings;
+}
+
+BoundingBox Subprocess::getBoundingBox(const SegmentSource &source) {
+    std::vector<BoundingBox> boxes(ThreadUtilities::getThreadCount(), {0.0f, 0.0f, 0.0f, 0.0f});
+    source([&](size_t thread, F32, F32, F32 x2, F32 y2, F32) {
+        BoundingBox &box = boxes[thread];
+        box[0] = std::min(box[0], x2);
+        box[1] = std::min(box[1], y2);
+        box[2] = std::max(box[2], x2);
+        box[3] = std::max(box[3], y2);
+    });
+    BoundingBox box = boxes[0];
+    for (const BoundingBox &threadBox : boxes) {
+        box = {
+            std::min(box[0], threadBox[0]), std::min(box[1], threadBox[1]),
+            std::max(box[2], threadBox[2]), std::max(box[3], threadBox[3])
+        };
+    }
+    return box;
+}
+
+F32 Subprocess::getPixelFootprint(const BoundingBox &box, const Config &config) {
+    if (config.at("level-of-detail") != "Merge") {
+        return 0.0f;
+    }
+    const ImageDimensions dimensions = ConfigUtilities::getDimensions(config.at("image-size"));
+    const uint32_t paddingSize = SubprocessUtilities::paddingSize;
+    const uint32_t width = dimensions.first > paddingSize ? dimensions.first - paddingSize : dimensions.first;
+    const uint32_t height = dimensions.second > paddingSize ? dimensions.second - paddingSize : dimensions.second;
+
+    // The parent process fits the longest side of the bounding box to the padded image.
+    // Taking the larger side of the image keeps the footprint within a pixel on both axes.
+    const F32 longestSide = std::max(box[2] - box[0], box[3] - box[1]);
+    return longestSide / static_cast<F32>(std::max({width, height, 1u}));
+}
+
+std::unordered_map<std::string, std::vector<F32>> Subprocess::getCoordinates(const SegmentSource &source, const Config &config) {
+    const GeometrySettings settings = getGeometrySettings(config);
     static const std::vector<std::string> parameters = {"x1", "x2", "x3", "x4", "y1", "y2", "y3", "y4"};
     static const size_t parameterCount = parameters.size();
-    static const F32 decay = 0.99;
-    static float angleIfOdd = MathUtilities::getRadians(ConfigUtilities::getFloatValue(config.at("angle-if-odd")));
-    static float angleIfEven = MathUtilities::getRadians(ConfigUtilities::getFloatValue(config.at("angle-if-even")));
-    static bool isLogarithmic = scaling == "Logarithmic";
-    const size_t sequencesSize = sequences.size();
-    std::unordered_map<std::string, std::vector<F32>> coordinates = {};
-    std::vector<std::vector<F32>*> coordinatePtrs(parameterCount);
-    uint32_t segmentSum = 0;
+    static const F32 normal = MathUtilities::getRadians(90);
+    std::vector<std::vector<std::array<F32, 8>>> threadSegments(ThreadUtilities::getThreadCount());
+    source([&](size_t thread, F32 x1, F32 y1, F32 x2, F32 y2, F32 theta) {
+        const F32 widthX = settings.lineWidth * std::cos(normal + theta);
+        const F32 widthY = settings.lineWidth * std::sin(normal + theta);
+        threadSegments[thread].push_back({x1, x2, x2 + widthX, x1 + widthX, y1, y2, y2 + widthY, y1 + widthY});
+    });
 
-    for (const std::vector<uint64_t> &sequence : sequences) {
-        segmentSum += sequence.size() - 1;
+    size_t segmentSum = 0;
+    for (const std::vector<std::array<F32, 8>> &segments : threadSegments) {
+        segmentSum += segments.size();
     }
+    std::unordered_map<std::string, std::vector<F32>> coordinates = {};
     for (size_t i = 0; i < parameterCount; ++i) {
-        coordinates[parameters[i]] = std::vector<float>(segmentSum);
-        coordinatePtrs[i] = &coordinates.at(parameters[i]);
-    }
-
-    size_t sequenceStartIndex = 0;
-    for (size_t i = 0; i < sequencesSize; ++i) {
-        F32 currentLineLength = lineLength;
-        const std::vector<uint64_t>& sequence = sequences[i];
-        const size_t sequenceSize = sequence.size();
-        const F32 initialTheta = MathUtilities::getRadians(90.0);
-        F32 currentTheta = initialTheta;
-        (*coordinatePtrs[0])[sequenceStartIndex] = 0.0;
-        (*coordinatePtrs[4])[sequenceStartIndex] = 0.0;
-
-        for (size_t j = sequenceSize - 1; j > 0; --j) { // Moves backward, Starts at 1 in the sequence, until the sequence ends at N.
-            const size_t vectorIndex = sequenceStartIndex + sequenceSize - 1 - j; // The last segment in the sequence, (1 -> 2) is the first index for the coordinates.
-            const F32 theta = (sequence[j] & 0b1 == 0b1 ? angleIfOdd : angleIfEven) + currentTheta;
-            (*coordinatePtrs[1])[vectorIndex] = (*coordinatePtrs[0])[vectorIndex] + currentLineLength * std::cosf(theta);
-            (*coordinatePtrs[5])[vectorIndex] = (*coordinatePtrs[4])[vectorIndex] + currentLineLength * std::sinf(theta);
-            (*coordinatePtrs[2])[vectorIndex] = (*coordinatePtrs[1])[vectorIndex] + lineWidth * std::cosf(MathUtilities::getRadians(90) + theta);
-            (*coordinatePtrs[6])[vectorIndex] = (*coordinatePtrs[5])[vectorIndex] + lineWidth * std::sinf(MathUtilities::getRadians(90) + theta);
-            (*coordinatePtrs[3])[vectorIndex] = (*coordinatePtrs[0])[vectorIndex] + lineWidth * std::cosf(MathUtilities::getRadians(90) + theta);
-            (*coordinatePtrs[7])[vectorIndex] = (*coordinatePtrs[4])[vectorIndex] + lineWidth * std::sinf(MathUtilities::getRadians(90) + theta);
-            if (j > 1) {
-                (*coordinatePtrs[0])[vectorIndex + 1] = (*coordinatePtrs[1])[vectorIndex];
-                (*coordinatePtrs[4])[vectorIndex + 1] = (*coordinatePtrs[5])[vectorIndex];
-            }
-            if (isLogarithmic) {
-                currentLineLength *= decay;
-            }   
-            currentTheta = theta;
-        }
-        sequenceStartIndex += sequenceSize - 1;
+        std::vector<F32> &coordinate = coordinates[parameters[i]];
+        coordinate.reserve(segmentSum);
+        for (const std::vector<std::array<F32, 8>> &segments : threadSegments) {
+            for (const std::array<F32, 8> &segment : segments) {
+                coordinate.push_back(segment[i]);
+            }
+        }
     }
     return coordinates;
 }
 
-std::unordered_map<std::string, std::vector<uint8_t>> Subprocess::getStyles(
-    const std::vector<std::vector<uint64_t>> &sequences
+SegmentSource Subprocess::getSequenceSource(
+    const std::vector<std::vector<uint64_t>> &sequences, const std::vector<size_t> &indices, const Config &config,
+    F32 pixelFootprint
 ) {
-    static const RGBA backgroundColor = ConfigUtilities::getRGBA(config.at("background-color"));
-    static const RGBA color = ConfigUtilities::getRGBA(config.at("color"));
+    static const size_t sequenceChunkSize = 64;
+    GeometrySettings settings = getGeometrySettings(config);
+    settings.pixelFootprint = pixelFootprint;
+    return [&sequences, &indices, settings](const SegmentCallback &onSegment) {
+        ThreadUtilities::parallelFor(indices.size(), sequenceChunkSize, [&](size_t thread, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                SubprocessUtilities::traceSequence(sequences[indices[i]], settings, [&](F32 x1, F32 y1, F32 x2, F32 y2, F32 theta) {
+                    onSegment(thread, x1, y1, x2, y2, theta);
+                });
+            }
+        });
+    };
+}
+
+SegmentSource Subprocess::getInverseTreeSource(uint32_t depth, uint64_t valueCap, const Config &config) {
+    static const size_t frontierChunkSize = 256;
+    const GeometrySettings settings = getGeometrySettings(config);
+    return [settings, depth, valueCap](const SegmentCallback &onSegment) {
+        const uint64_t cap = valueCap == 0 ? std::numeric_limits<uint64_t>::max() : valueCap;
+        std::vector<TreeNode> frontier = {{1, 0.0f, 0.0f, MathUtilities::getRadians(90.0), settings.lineLength}};
+        for (uint32_t level = 0; level < depth && !frontier.empty(); ++level) {
+            std::vector<std::vector<TreeNode>> nextFrontiers(ThreadUtilities::getThreadCount());
+            ThreadUtilities::parallelFor(frontier.size(), frontierChunkSize, [&](size_t thread, size_t begin, size_t end) {
+                std::vector<TreeNode> &next = nextFrontiers[thread];
+                for (size_t i = begin; i < end; ++i) {
+                    const TreeNode &parent = frontier[i];
+
+                    // Same as `traceSequence`, the turn depends on the parity of the value closer to 1.
+                    const F32 theta = ((parent.value & 0b1) == 0b1 ? settings.angleIfOdd : settings.angleIfEven) + parent.theta;
+                    const F32 x = parent.x + parent.length * std::cos(theta);
+                    const F32 y = parent.y + parent.length * std::sin(theta);
+                    const F32 length = settings.isLogarithmic ? parent.length * SubprocessUtilities::decay : parent.length;
+
+                    // m -> 2m, always valid unless it overflows.
+                    if (parent.value <= cap / 2) {
+                        onSegment(thread, parent.x, parent.y, x, y, theta);
+                        next.push_back({parent.value * 2, x, y, theta, length});
+                    }
+
+                    // m -> (m - 1) / 3, valid if it is an odd integer greater than 1.
+                    if (parent.value % 6 == 4 && parent.value > 4) {
+                        onSegment(thread, parent.x, parent.y, x, y, theta);
+                        next.push_back({(parent.value - 1) / 3, x, y, theta, length});
+                    }
+                }
+            });
+            frontier.clear();
+            for (const std::vector<TreeNode> &next : nextFrontiers) {
+                frontier.insert(frontier.end(), next.begin(), next.end());
+            }
+        }
+    };
+}
+
+std::string Subprocess::getDensityImage(const SegmentSource &source, const BoundingBox &box, const Config &config) {
+    const ImageDimensions dimensions = ConfigUtilities::getDimensions(config.at("image-size"));
+    const RGBA backgroundColor = ConfigUtilities::getRGBA(config.at("background-color"));
+    const Gradient gradient = ConfigUtilities::getGradient(config.at("gradient"));
+    const bool isHistogram = config.at("tone-mapping") == "Histogram";
+    static const uint32_t paddingSize = SubprocessUtilities::paddingSize;
+    static const size_t pixelChunkSize = 1 << 16;
+    static const size_t levelCount = 256;
+    const size_t threadCount = ThreadUtilities::getThreadCount();
+    const uint32_t width = dimensions.first;
+    const uint32_t height = dimensions.second;
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+
+    // Uniform scale that fits the bounding box within the padded image, centered.
+    const F32 innerWidth = static_cast<F32>(width > paddingSize ? width - paddingSize : width);
+    const F32 innerHeight = static_cast<F32>(height > paddingSize ? height - paddingSize : height);
+    const F32 spanX = std::max(box[2] - box[0], std::numeric_limits<F32>::epsilon());
+    const F32 spanY = std::max(box[3] - box[1], std::numeric_limits<F32>::epsilon());
+    const F32 scale = std::min((innerWidth - 1) / spanX, (innerHeight - 1) / spanY);
+    const F32 offsetX = (width - spanX * scale) / 2 - box[0] * scale;
+    const F32 offsetY = (height - spanY * scale) / 2 - box[1] * scale;
+
+    // Rasterize centerlines into per-thread grids. The end point of a segment is the start of the next.
+    // A chain only counts once per pixel it crosses, so a run of sub-pixel segments does not pile up in one pixel.
+    std::vector<std::vector<uint32_t>> grids(threadCount);
+    std::vector<size_t> lastPixels(threadCount, pixelCount);
+    source([&](size_t thread, F32 x1, F32 y1, F32 x2, F32 y2, F32) {
+        std::vector<uint32_t> &grid = grids[thread];
+        size_t &lastPixel = lastPixels[thread];
+        if (grid.empty()) {
+            grid.assign(pixelCount, 0);
+        }
+        const F32 px = x1 * scale + offsetX;
+        const F32 py = y1 * scale + offsetY;
+        const F32 dx = (x2 - x1) * scale;
+        const F32 dy = (y2 - y1) * scale;
+        const uint32_t steps = std::max(1u, static_cast<uint32_t>(std::ceil(std::max(std::abs(dx), std::abs(dy)))));
+        for (uint32_t step = 0; step < steps; ++step) {
+            const F32 t = static_cast<F32>(step) / steps;
+            const int64_t column = static_cast<int64_t>(px + dx * t);
+            const int64_t row = static_cast<int64_t>(height) - 1 - static_cast<int64_t>(py + dy * t);
+            if (column >= 0 && column < width && row >= 0 && row < height) {
+                const size_t pixel = static_cast<size_t>(row) * width + column;
+                if (pixel != lastPixel) {
+                    ++grid[pixel];
+                    lastPixel = pixel;
+                }
+            }
+        }
+    });
+
+    // Merge the grids into one.
+    std::vector<uint32_t> density(pixelCount, 0);
+    ThreadUtilities::parallelFor(pixelCount, pixelChunkSize, [&](size_t, size_t begin, size_t end) {
+        for (const std::vector<uint32_t> &grid : grids) {
+            if (grid.empty()) {
+                continue;
+            }
+            for (size_t i = begin; i < end; ++i) {
+                density[i] += grid[i];
+            }
+        }
+    });
+    grids.clear();
+
+    // Tone mapping. Maps every non-zero count to one of `levelCount` gradient levels.
+    std::vector<RGBA> palette(levelCount);
+    const HSVA gradientStart = ColorUtilities::RGBAToHSVA(gradient.first);
+    const HSVA gradientEnd = ColorUtilities::RGBAToHSVA(gradient.second);
+    for (size_t i = 0; i < levelCount; ++i) {
+        palette[i] = ColorUtilities::getRGBASegmentValue(gradientStart, gradientEnd, i, levelCount);
+    }
+    const uint32_t maxCount = density.empty() ? 0 : VectorUtilities::getMax(density);
+    std::vector<uint32_t> sortedCounts = {};
+    if (isHistogram) {
+        for (const uint32_t count : density) {
+            if (count > 0) {
+                sortedCounts.push_back(count);
+            }
+        }
+        std::sort(sortedCounts.begin(), sortedCounts.end());
+    }
+    const F32 logMax = std::log1p(static_cast<F32>(maxCount));
+
+    std::string imageData(sizeof(uint32_t) * 2 + sizeof(RGBA) + pixelCount * sizeof(RGBA), '\0');
+    char *bufferPtr = imageData.data();
+    std::memcpy(bufferPtr, &width, sizeof(uint32_t));
+    std::memcpy(bufferPtr + sizeof(uint32_t), &height, sizeof(uint32_t));
+    std::memcpy(bufferPtr + sizeof(uint32_t) * 2, &backgroundColor, sizeof(RGBA));
+    RGBA *pixels = reinterpret_cast<RGBA *>(bufferPtr + sizeof(uint32_t) * 2 + sizeof(RGBA));
+    ThreadUtilities::parallelFor(pixelCount, pixelChunkSize, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const uint32_t count = density[i];
+            if (count == 0) {
+                pixels[i] = backgroundColor;
+                continue;
+            }
+            F32 level = 0.0f;
+            if (isHistogram) {
+                const size_t rank = std::upper_bound(sortedCounts.begin(), sortedCounts.end(), count) - sortedCounts.begin();
+                level = static_cast<F32>(rank) / sortedCounts.size();
+            } else {
+                level = std::log1p(static_cast<F32>(count)) / logMax;
+            }
+            pixels[i] = palette[std::min(levelCount - 1, static_cast<size_t>(level * (levelCount - 1)))];
+        }
+    });
+    return imageData;
+}
+
+std::unordered_map<std::string, std::vector<uint8_t>> Subprocess::getStyles(size_t segmentCount, const Config &config) {
+    const RGBA color = ConfigUtilities::getRGBA(config.at("color"));
     static const std::vector<std::string> components = {"r", "g", "b", "a"};
     static const size_t componentCount = components.size();
     std::unordered_map<std::string, std::vector<uint8_t>> colors = {};
     std::vector<std::vector<uint8_t>*> colorPtrs = {};
-    size_t segmentCount = 0;
-    for (const std::vector<uint64_t> &sequence : sequences) {
-        segmentCount += sequence.size() - 1;
-    }
     for (std::string comp : components) {
         colors[comp] = std::vector<uint8_t>(segmentCount);
         colorPtrs.push_back(&colors[comp]);
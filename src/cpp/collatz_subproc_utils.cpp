@@ -50,6 +50,66 @@ F32 MathUtilities::getRadians(F32 degrees)
     return degrees * (std::numbers::pi / 180);
 }
 
+// --------------------------------------- ThreadUtilities --------------------------------------- //
+
+size_t ThreadUtilities::getThreadCount()
+{
+    static const size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    return threadCount;
+}
+
+void ThreadUtilities::parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t, size_t)> &task)
+{
+    const size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    const size_t threadCount = std::min(getThreadCount(), chunkCount);
+
+    // Nested calls run on the calling thread, the outer call already occupies every thread.
+    static thread_local bool isWorkerThread = false;
+    if (threadCount <= 1 || isWorkerThread)
+    {
+        for (size_t begin = 0; begin < count; begin += chunkSize)
+        {
+            task(0, begin, std::min(count, begin + chunkSize));
+        }
+        return;
+    }
+    std::atomic<size_t> nextChunk = 0;
+    std::exception_ptr exception = nullptr;
+    std::atomic<bool> failed = false;
+    std::vector<std::thread> threads = {};
+    threads.reserve(threadCount);
+    for (size_t t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            isWorkerThread = true;
+            try
+            {
+                for (size_t chunk = nextChunk++; chunk < chunkCount && !failed; chunk = nextChunk++)
+                {
+                    const size_t begin = chunk * chunkSize;
+                    task(t, begin, std::min(count, begin + chunkSize));
+                }
+            }
+            catch (...)
+            {
+                if (!failed.exchange(true))
+                {
+                    exception = std::current_exception();
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    if (exception)
+    {
+        std::rethrow_exception(exception);
+    }
+}
+
 // --------------------------------------- ColorUtilities --------------------------------------- //
 
 RGBA ColorUtilities::HSVAToRGBA(const HSVA &hsva)
@@ -148,7 +208,16 @@ HSVA ColorUtilities::RGBAToHSVA(const RGBA &rgba)
     HSVA hsva = {hue, saturation, value, rgba[3] / 255.0f};
     return hsva;
 }
-
+RGBA ColorUtilities::getRGBASegmentValue(HSVA gradientStart, HSVA gradientEnd, uint32_t position, uint32_t nPositions)
+{
+    const F32 t = nPositions > 1 ? static_cast<F32>(std::min(position, nPositions - 1)) / (nPositions - 1) : 0.0f;
+    HSVA hsva = {};
+    for (size_t i = 0; i < hsva.size(); ++i)
+    {
+        hsva[i] = gradientStart[i] + (gradientEnd[i] - gradientStart[i]) * t;
+    }
+    return HSVAToRGBA(hsva);
+}
 
 // --------------------------------------- ConfigUtilities --------------------------------------- //
 
@@ -170,6 +239,10 @@ std::unordered_map<std::string, std::string> ConfigUtilities::getConfig(const fs
     {
         config[setting] = configFile[setting].as<std::string>();
     }
+    for (const auto &[setting, defaultValue] : optionalSettings)
+    {
+        config[setting] = configFile[setting] ? configFile[setting].as<std::string>() : defaultValue;
+    }
     return config;
 }
 
@@ -215,6 +288,17 @@ RGBA ConfigUtilities::getRGBA(const std::string &rgbaHex)
     return color;
 }
 
+Gradient ConfigUtilities::getGradient(const std::string &gradientHex)
+{
+    std::vector<std::string> colors = StringUtilities::split(gradientHex, ",");
+    if (colors.size() != 2)
+    {
+        throw std::invalid_argument("Invalid gradient format.");
+    }
+    Gradient gradient = {getRGBA(StringUtilities::strip(colors[0])), getRGBA(StringUtilities::strip(colors[1]))};
+    return gradient;
+}
+
 fs::path ConfigUtilities::getExecutablePath()
 {
     std::vector<char> buffer(MAX_PATH);
@@ -233,7 +317,7 @@ fs::path ConfigUtilities::getExecutablePath()
 Range SubprocessUtilities::getRange(const std::string &rangeStr)
 {
     std::vector<std::string> rangeStrVal = StringUtilities::split(rangeStr, " ");
-    if (rangeStrVal.size() != 2)
+    if (rangeStrVal.size() != 2 && rangeStrVal.size() != 3)
     {
         throw std::invalid_argument("Invalid range format received.");
     }
@@ -248,6 +332,45 @@ Range SubprocessUtilities::getRange(const std::string &rangeStr)
     }
 }
 
+uint32_t SubprocessUtilities::getSampleSize(const std::string &rangeStr, uint32_t defaultSampleSize)
+{
+    std::vector<std::string> rangeStrVal = StringUtilities::split(rangeStr, " ");
+    if (rangeStrVal.size() != 3)
+    {
+        return defaultSampleSize;
+    }
+    const uint32_t sampleSize = ConfigUtilities::getValue(rangeStrVal[2]);
+    if (sampleSize == 0)
+    {
+        throw std::invalid_argument("Invalid sample size received.");
+    }
+    return sampleSize;
+}
+
+BatchEntry SubprocessUtilities::getBatchEntry(const std::string &entryStr, const Config &config)
+{
+    std::vector<std::string> fields = StringUtilities::split(entryStr, "\t");
+    BatchEntry entry = {};
+    entry.config = config;
+    for (size_t i = 1; i < fields.size(); ++i)
+    {
+        const size_t separator = fields[i].find('=');
+        if (separator == std::string::npos)
+        {
+            throw std::invalid_argument("Invalid setting override format received.");
+        }
+        const std::string setting = StringUtilities::strip(fields[i].substr(0, separator));
+        if (!entry.config.contains(setting))
+        {
+            throw std::invalid_argument("Unknown setting override received: " + setting);
+        }
+        entry.config[setting] = StringUtilities::strip(fields[i].substr(separator + 1));
+    }
+    entry.range = getRange(fields[0]);
+    entry.sampleSize = getSampleSize(fields[0], ConfigUtilities::getValue(entry.config.at("sample-size")));
+    return entry;
+}
+
 std::string SubprocessUtilities::assembleValues(
     const std::unordered_map<std::string, std::vector<F32>> &coordinates,
     const std::unordered_map<std::string, std::vector<uint8_t>> &style,
@@ -1,7 +1,9 @@
-from typing import Dict, Any, Tuple
-from collatz_utils import Utilities, ImageData
+from typing import Dict, Any, Tuple, List, Optional, Iterator, Callable, TypeVar
+from collatz_utils import Utilities, ImageData, BatchResult, AnalyticsData
 from subprocess import Popen, PIPE
 from pathlib import Path
+from abc import ABC, abstractmethod
+from concurrent.futures import ThreadPoolExecutor, Future
 import struct
 import numpy as np
 import numpy.typing as npt
@@ -10,54 +12,141 @@ from time import sleep
 import moderngl as gl
 import os
 
+T = TypeVar("T")
+
 
 class Application:
+    # Raised when a worker dies or sends a short or malformed payload. Each fails only the shard it was raised for.
+    SHARD_ERRORS: Tuple[type[Exception], ...] = (
+        ChildProcessError,
+        IOError,
+        ValueError,
+        struct.error,
+    )
+
     def __init__(self, config: Dict[str, Any], relative_subproc_path: Path) -> None:
         """Default constructor."""
         self.subproc_path: Path = relative_subproc_path
         self.config: Dict[str, Any] = config
-        self.subproc: Popen[bytes] = Popen(
-            [relative_subproc_path],
-            text=False,
-            stdin=PIPE,
-            stdout=PIPE,
-            stderr=PIPE,
-        )
+        worker_count: int = max(1, int(config.get("workers", 1)))
+        self.workers: List[Worker] = [
+            Worker(i, PipeTransport(relative_subproc_path)) for i in range(worker_count)
+        ]
 
     def start(self) -> None:
         """Main entry point for the application."""
 
         # Test for subprocess response.
-        IPC.send(IPC.IPC_CODES["test"], self.subproc)
-        if (
-            IPC.receive(self.subproc, False).decode("ascii")
-            != IPC.IPC_CODES["test_suc"]
-        ):
-            raise ChildProcessError(f"Subprocess did not respond.")
+        for worker in self.workers:
+            worker.test()
 
         range: Tuple[int, int] = Utilities.getRange()
         if range == (-1, -1):
             self.quit()
-        IPC.send(f"{range[0]} {range[1]}", self.subproc)
-        bytes_to_read: int = 0
-        while True:
-            subproc_log_bytes: bytes = IPC.receive(self.subproc, False)
-            log_ascii_repr: str = subproc_log_bytes.decode("ascii")
-            if IPC.IPC_CODES["proc_fnsh"] not in log_ascii_repr:
-                print(log_ascii_repr)
-                continue
-            elif IPC.IPC_CODES["proc_fnsh"] in log_ascii_repr:
-                bytes_to_read = int(
-                    log_ascii_repr.removeprefix(IPC.IPC_CODES["proc_fnsh"])
-                )
-            IPC.send(IPC.IPC_CODES["send_data"], self.subproc)
-            break
-        subproc_data_bytes: bytes = IPC.receive(self.subproc, True, bytes_to_read)
-        image_data: ImageData = self.get_data(subproc_data_bytes)
-        image: Image.Image = self.render_image(image_data)
+        image: Image.Image
+        is_density: bool = self.config.get("render-mode", "Segments") == "Density"
+        is_tree: bool = self.config.get("generation", "Forward") == "Inverse-tree"
+        if is_density or is_tree:
+            image_bytes: bytes = self.run_single(range)
+            image = (
+                self.get_density_image(image_bytes)
+                if is_density
+                else self.render_image(self.get_data(image_bytes))
+            )
+        else:
+            image_data: ImageData = self.run_shards(range)
+            image = self.render_image(image_data)
         self.save_image(image)
 
-    def get_data(self, image_bytes: bytes) -> ImageData:
+    def run_single(self, value_range: Tuple[int, int]) -> bytes:
+        """Has a single worker evaluate the whole range, then returns the raw payload."""
+        # Density tone mapping needs the whole grid, and the inverse tree is grown from 1 rather than split by range.
+        for worker in self.workers:
+            if not worker.transport.alive():
+                continue
+            try:
+                return worker.request(value_range)
+            except Application.SHARD_ERRORS as e:
+                print(f"[Worker {worker.worker_id}] Failed: {e}")
+        raise ChildProcessError("All workers failed.")
+
+    def run_shards(self, value_range: Tuple[int, int]) -> ImageData:
+        """Splits the range across all workers, then merges their image data."""
+        shards: List[Tuple[int, int]] = Utilities.getShards(
+            value_range, len(self.workers)
+        )
+        sample_sizes: List[Optional[int]] = [None] * len(shards)
+
+        # In "Random" mode, each shard receives a share of the sample size proportional to its span.
+        if self.config["mode"] == "Random" and len(shards) > 1:
+            sample_size: int = int(self.config["sample-size"])
+            span: int = value_range[1] - value_range[0]
+            sample_sizes = [
+                max(1, sample_size * (shard[1] - shard[0]) // span) for shard in shards
+            ]
+
+        results: List[Optional[ImageData]] = self.dispatch_shards(
+            shards, lambda worker, i: worker.run(shards[i], sample_sizes[i])
+        )
+        for shard, result in zip(shards, results):
+            if result is None:
+                print(f"Shard {shard[0]} -> {shard[1]} dropped.")
+
+        completed: List[ImageData] = [r for r in results if r is not None]
+        if not completed:
+            raise ChildProcessError("All workers failed.")
+        return Utilities.mergeImageData(completed)
+
+    def run_analytics(self, value_range: Tuple[int, int]) -> AnalyticsData:
+        """Splits the range across all workers for per-n trajectory statistics, then merges them."""
+        shards: List[Tuple[int, int]] = Utilities.getShards(
+            value_range, len(self.workers)
+        )
+        results: List[Optional[AnalyticsData]] = self.dispatch_shards(
+            shards, lambda worker, i: self.get_analytics(worker.request(shards[i], analytics=True))
+        )
+
+        # Unlike images, the columns are only meaningful if every shard is present.
+        completed: List[AnalyticsData] = [r for r in results if r is not None]
+        if len(completed) != len(shards):
+            raise ChildProcessError("Not every shard could be evaluated.")
+        return Utilities.mergeAnalytics(completed)
+
+    def dispatch_shards(
+        self, shards: List[Tuple[int, int]], task: Callable[["Worker", int], T]
+    ) -> List[Optional[T]]:
+        """Runs `task(worker, shard_index)` for every shard, one worker each, in parallel.
+
+        Shards whose worker fails are retried sequentially on workers that are still alive.
+        A worker that fails mid-exchange is discarded by `Worker`, so it is never retried.
+        The result of a shard that could not be evaluated at all is None.
+        """
+        results: List[Optional[T]] = [None] * len(shards)
+        with ThreadPoolExecutor(max_workers=len(shards)) as executor:
+            futures: List[Future[T]] = [
+                executor.submit(task, self.workers[i], i) for i in range(len(shards))
+            ]
+            for i, future in enumerate(futures):
+                try:
+                    results[i] = future.result()
+                except Application.SHARD_ERRORS as e:
+                    print(f"[Worker {self.workers[i].worker_id}] Failed: {e}")
+
+        for i in range(len(shards)):
+            if results[i] is not None:
+                continue
+            for worker in self.workers:
+                if not worker.transport.alive():
+                    continue
+                try:
+                    results[i] = task(worker, i)
+                    break
+                except Application.SHARD_ERRORS as e:
+                    print(f"[Worker {worker.worker_id}] Failed: {e}")
+        return results
+
+    @staticmethod
+    def get_data(image_bytes: bytes) -> ImageData:
         """Transfers the data from the IPC to a format readable by python via NumPy."""
         segment_count: np.uint32 = np.uint32(struct.unpack("<I", image_bytes[:4])[0])
         background_color: npt.NDArray[np.uint8] = np.array(
@@ -84,7 +173,89 @@ class Application:
             image_data_body,
             dtype=data_type,
         )
-        return ImageData(segment_count, background_color, image_data_np)
+        bounding_box: Tuple[float, float, float, float] = (0.0, 0.0, 0.0, 0.0)
+        if image_data_np.shape[0] > 0:
+            xs: npt.NDArray[np.float32] = np.stack(
+                [image_data_np[f"x{i}"] for i in range(1, 5)]
+            )
+            ys: npt.NDArray[np.float32] = np.stack(
+                [image_data_np[f"y{i}"] for i in range(1, 5)]
+            )
+            bounding_box = (
+                float(np.min(xs)),
+                float(np.min(ys)),
+                float(np.max(xs)),
+                float(np.max(ys)),
+            )
+        return ImageData(segment_count, background_color, image_data_np, bounding_box)
+
+
+    def run_batch(
+        self, entries: List[Tuple[Tuple[int, int], Dict[str, Any]]]
+    ) -> Iterator[Tuple[int, Image.Image]]:
+        """Evaluates many (range, config override) entries in one request, yielding each image as it arrives."""
+        # The subprocess evaluates the union of all ranges once, so the batch is not sharded.
+        worker: Worker = next(w for w in self.workers if w.transport.alive())
+        for result in worker.request_batch(entries):
+            if result.error is not None:
+                print(f"[Worker {worker.worker_id}] Entry {result.index} failed: {result.error}")
+                continue
+            overrides: Dict[str, Any] = entries[result.index][1]
+            if overrides.get("render-mode", self.config.get("render-mode")) == "Density":
+                yield result.index, self.get_density_image(result.payload)
+            else:
+                yield result.index, self.render_image(self.get_data(result.payload))
+
+    @staticmethod
+    def get_analytics(analytics_bytes: bytes) -> AnalyticsData:
+        """Transfers per-n trajectory statistics from the IPC to a format readable by python via NumPy."""
+        offset: int = 0
+
+        def column(dtype: Any, count: int) -> npt.NDArray[Any]:
+            nonlocal offset
+            values: npt.NDArray[Any] = np.frombuffer(
+                analytics_bytes, dtype=dtype, count=count, offset=offset
+            )
+            offset += values.nbytes
+            return values
+
+        start, count = (int(v) for v in column("<u8", 2))
+        max_values: npt.NDArray[np.uint64] = column("<u8", count)
+        stopping_times: npt.NDArray[np.uint32] = column("<u4", count)
+        odd_steps: npt.NDArray[np.uint32] = column("<u4", count)
+        stopping_time_histogram: npt.NDArray[np.uint64] = column(
+            "<u8", int(column("<u8", 1)[0])
+        )
+        odd_step_histogram: npt.NDArray[np.uint64] = column(
+            "<u8", int(column("<u8", 1)[0])
+        )
+        records: List[npt.NDArray[Any]] = []
+        for _ in range(2):
+            record_count: int = int(column("<u8", 1)[0])
+            holders: npt.NDArray[np.uint64] = column("<u8", record_count)
+            values: npt.NDArray[np.uint64] = column("<u8", record_count)
+            record: npt.NDArray[Any] = np.empty(
+                record_count, dtype=AnalyticsData.RECORD_DTYPE
+            )
+            record["n"] = holders
+            record["value"] = values
+            records.append(record)
+        return AnalyticsData(
+            start,
+            stopping_times,
+            max_values,
+            odd_steps,
+            stopping_time_histogram,
+            odd_step_histogram,
+            records[0],
+            records[1],
+        )
+
+    @staticmethod
+    def get_density_image(image_bytes: bytes) -> Image.Image:
+        """Transfers a tone mapped density image from the IPC to an Image object."""
+        width, height = struct.unpack("<2I", image_bytes[:8])
+        return Image.frombytes("RGBA", (width, height), image_bytes[12:])
 
     def render_image(self, image_data: ImageData) -> Image.Image:
         """Renders an image, then returns the final image as an Image object."""
@@ -117,15 +288,12 @@ class Application:
 
         # Transform to NDC (Normalized Device Coordinates).
         # Get min, max, center x and y for scaling purposes.
-        min_x: np.float32 = np.min(vbo_data["x"])
-        min_y: np.float32 = np.min(vbo_data["y"])
-        max_x: np.float32 = np.max(vbo_data["x"])
-        max_y: np.float32 = np.max(vbo_data["y"])
-        center_x: np.float32 = (min_x + max_x) / 2
-        center_y: np.float32 = (min_y + max_y) / 2
-        width: np.float32 = max_x - min_x
-        height: np.float32 = max_y - min_y
-        longest_side_length: np.float32 = width if height < width else height
+        min_x, min_y, max_x, max_y = image_data.bounding_box
+        center_x: float = (min_x + max_x) / 2
+        center_y: float = (min_y + max_y) / 2
+        width: float = max_x - min_x
+        height: float = max_y - min_y
+        longest_side_length: float = width if height < width else height
 
         # To NDC.
         vbo_data["x"] = (vbo_data["x"] - center_x) * 2 / longest_side_length
@@ -249,9 +417,10 @@ class Application:
 
     def quit(self) -> None:
         """Gracefully terminates the process."""
-        IPC.send(IPC.IPC_CODES["terminate"], self.subproc)
+        for worker in self.workers:
+            worker.transport.close()
         sleep(0.1)
-        if self.subproc.returncode:
+        if not any(worker.transport.alive() for worker in self.workers):
             exit(0)
         else:
             raise ChildProcessError("Subprocess did not terminate.")
@@ -267,6 +436,10 @@ class IPC:
         "proc_fnsh": "/2",
         "send_data": "/3",
         "terminate": "/-1",
+        "batch": "/4",
+        "batch_frame": "/5",
+        "batch_error": "/6",
+        "analytics": "/7",
     }
 
     @classmethod
@@ -297,3 +470,169 @@ class IPC:
                 else proc.stderr.read(bytes_to_read)
             )
         return byte_message.decode("latin-1").removesuffix("\n").encode("latin-1")
+
+
+class Transport(ABC):
+    """A channel to a single worker. Implementations decide how the bytes travel (pipes, sockets, etc.)."""
+
+    @abstractmethod
+    def send(self, message: str) -> None:
+        """Sends a text message to the worker."""
+
+    @abstractmethod
+    def receive_log(self) -> bytes:
+        """Receives a single line from the worker's log channel, is a blocking operation."""
+
+    @abstractmethod
+    def receive_data(self, bytes_to_read: int) -> bytes:
+        """Receives exactly `bytes_to_read` bytes from the worker's data channel, is a blocking operation."""
+
+    @abstractmethod
+    def alive(self) -> bool:
+        """Whether the worker can still accept requests."""
+
+    @abstractmethod
+    def close(self) -> None:
+        """Asks the worker to terminate."""
+
+    @abstractmethod
+    def kill(self) -> None:
+        """Terminates the worker immediately, discarding anything left unread in its channels."""
+
+
+class PipeTransport(Transport):
+    """Transport to a local subprocess over its standard streams."""
+
+    def __init__(self, subproc_path: Path) -> None:
+        """Default constructor. Spawns the subprocess."""
+        self.subproc: Popen[bytes] = Popen(
+            [subproc_path],
+            text=False,
+            stdin=PIPE,
+            stdout=PIPE,
+            stderr=PIPE,
+        )
+
+    def send(self, message: str) -> None:
+        IPC.send(message, self.subproc)
+
+    def receive_log(self) -> bytes:
+        return IPC.receive(self.subproc, False)
+
+    def receive_data(self, bytes_to_read: int) -> bytes:
+        # Reads the trailing terminator too, so the next payload starts aligned.
+        return IPC.receive(
+            self.subproc, True, bytes_to_read + len(IPC.IPC_CODES["send"])
+        )
+
+    def alive(self) -> bool:
+        return self.subproc.poll() is None
+
+    def close(self) -> None:
+        if self.alive():
+            IPC.send(IPC.IPC_CODES["terminate"], self.subproc)
+
+    def kill(self) -> None:
+        if self.alive():
+            self.subproc.kill()
+        self.subproc.wait()
+
+
+class Worker:
+    """Runs shards on a single subprocess through a `Transport`."""
+
+    def __init__(self, worker_id: int, transport: Transport) -> None:
+        """Default constructor."""
+        self.worker_id: int = worker_id
+        self.transport: Transport = transport
+
+    def discard(self) -> None:
+        """Stops the worker after a failed exchange, as anything left unread would misalign its next request."""
+        print(f"[Worker {self.worker_id}] Discarded.")
+        self.transport.kill()
+
+    def test(self) -> None:
+        """Tests for a response from the worker."""
+        self.transport.send(IPC.IPC_CODES["test"])
+        if self.transport.receive_log().decode("ascii") != IPC.IPC_CODES["test_suc"]:
+            raise ChildProcessError(f"Worker {self.worker_id} did not respond.")
+
+    def run(
+        self, shard: Tuple[int, int], sample_size: Optional[int] = None
+    ) -> ImageData:
+        """Evaluates a shard and returns its image data. Raises `ChildProcessError` if the worker dies."""
+        return Application.get_data(self.request(shard, sample_size))
+
+    def request(
+        self,
+        shard: Tuple[int, int],
+        sample_size: Optional[int] = None,
+        analytics: bool = False,
+    ) -> bytes:
+        """Evaluates a shard and returns the raw payload. Raises `ChildProcessError` if the worker dies."""
+        request: str = f"{shard[0]} {shard[1]}"
+        if sample_size is not None:
+            request += f" {sample_size}"
+        if analytics:
+            request = f"{IPC.IPC_CODES["analytics"]} {request}"
+        try:
+            self.transport.send(request)
+            bytes_to_read: int = 0
+            while True:
+                if not self.transport.alive():
+                    raise ChildProcessError(f"Worker {self.worker_id} terminated.")
+                log_ascii_repr: str = self.transport.receive_log().decode("ascii")
+                if IPC.IPC_CODES["proc_fnsh"] not in log_ascii_repr:
+                    if log_ascii_repr:
+                        print(f"[Worker {self.worker_id}] {log_ascii_repr}")
+                    continue
+                bytes_to_read = int(log_ascii_repr.removeprefix(IPC.IPC_CODES["proc_fnsh"]))
+                self.transport.send(IPC.IPC_CODES["send_data"])
+                break
+            data_bytes: bytes = self.transport.receive_data(bytes_to_read)
+            if len(data_bytes) != bytes_to_read:
+                raise ChildProcessError(f"Worker {self.worker_id} sent incomplete data.")
+            return data_bytes
+        except BaseException:
+            self.discard()
+            raise
+
+    def request_batch(
+        self, entries: List[Tuple[Tuple[int, int], Dict[str, Any]]]
+    ) -> Iterator[BatchResult]:
+        """Sends a batch of (range, config override) entries, yielding each response as it arrives, in any order."""
+        lines: List[str] = []
+        for (start, end), overrides in entries:
+            line: str = f"{start} {end}" + "".join(
+                f"\t{setting}={value}" for setting, value in overrides.items()
+            )
+            if "\n" in line or line.count("\t") != len(overrides):
+                raise ValueError("Setting overrides cannot contain tabs or newlines.")
+            lines.append(line)
+        try:
+            self.transport.send(f"{IPC.IPC_CODES["batch"]} {len(lines)}")
+            for line in lines:
+                self.transport.send(line)
+
+            remaining: int = len(lines)
+            while remaining > 0:
+                if not self.transport.alive():
+                    raise ChildProcessError(f"Worker {self.worker_id} terminated.")
+                log_repr: str = self.transport.receive_log().decode("latin-1")
+                if log_repr.startswith(f"{IPC.IPC_CODES["batch_frame"]} "):
+                    _, index, bytes_to_read = log_repr.split(" ")
+                    data_bytes: bytes = self.transport.receive_data(int(bytes_to_read))
+                    if len(data_bytes) != int(bytes_to_read):
+                        raise ChildProcessError(f"Worker {self.worker_id} sent incomplete data.")
+                    yield BatchResult(int(index), data_bytes, None)
+                    remaining -= 1
+                elif log_repr.startswith(f"{IPC.IPC_CODES["batch_error"]} "):
+                    _, index, error = log_repr.split(" ", 2)
+                    yield BatchResult(int(index), b"", error)
+                    remaining -= 1
+                elif log_repr:
+                    print(f"[Worker {self.worker_id}] {log_repr}")
+        except BaseException:
+            # Includes the caller closing the generator before every entry is received.
+            self.discard()
+            raise
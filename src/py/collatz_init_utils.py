@@ -10,6 +10,13 @@ config_default: List[str] = [
     r'# Note: A sample size greater than the specified range will cap out at the range value, acting as "Continuous".',
     r"sample-size: 5000",
     r"",
+    r'# Options: "Forward", "Inverse-tree"',
+    r'# Note: "Inverse-tree" grows the tree of all numbers within "tree-depth" steps of 1, instead of evaluating each n in the range. The end of the range caps the values drawn.',
+    r'generation: "Forward"',
+    r"",
+    r'# Options: (Any number >= 1). Only used if "generation" is set to "Inverse-tree".',
+    r"tree-depth: 30",
+    r"",
     r'# Options: "Linear", "Logarithmic".',
     r'scaling: "Linear" #',
     r"",
@@ -19,6 +26,14 @@ config_default: List[str] = [
     r"",
     r"# --------- Style Settings --------- #",
     r"",
+    r'# Options: "Segments", "Density"',
+    r'# Note: "Density" counts how many sequences cross each pixel and colors pixels by that count through "gradient", instead of drawing each segment.',
+    r'render-mode: "Segments"',
+    r"",
+    r'# Options: "Logarithmic", "Histogram"',
+    r'# Note: Only used if "render-mode" is set to "Density". "Histogram" spreads the counts evenly across the gradient.',
+    r'tone-mapping: "Logarithmic"',
+    r"",
     r'# Options: "Flat", "Gradient"',
     r'color-scheme: "Gradient"',
     r"",
@@ -40,4 +55,19 @@ config_default: List[str] = [
     r"",
     r"# Options: (Any number, [Width]x[Height] in px. Extremely large image sizes will impact performance significantly).",
     r'image-size: "2000x2000" #',
+    r"",
+    r"# --------- Performance Settings --------- #",
+    r"",
+    r"# Options: (Any number >= 1). The range is split across this many subprocesses.",
+    r"# Note: Shards are balanced by estimated total stopping time, not by count. A worker that crashes only loses its own shard.",
+    r"workers: 1",
+    r"",
+    r"# Options: (Any number >= 0). Trajectory statistics are stored on disk for every n up to this bound and reused across analytics runs. 0 disables it.",
+    r"# Note: Each record takes 32 bytes. The database only grows as far as the ranges analysed, renders never extend it.",
+    r"# Note: Growing it takes about as long as analysing every n up to the new end. It is grown with every thread of one worker, while other workers wait for it.",
+    r"database-bound: 0",
+    r"",
+    r'# Options: "Merge", "Off".',
+    r'# Note: "Merge" joins runs of segments shorter than a pixel at "image-size" into one segment per pixel, shrinking the data sent and the time to draw deep "Logarithmic" trajectories.',
+    r'level-of-detail: "Merge"',
 ]
@@ -1,6 +1,7 @@
-from typing import Tuple, Any
+from typing import Tuple, List, Any, Optional, ClassVar
 from re import fullmatch
 from dataclasses import dataclass
+from math import log
 import numpy.typing as npt
 import numpy as np
 
@@ -20,6 +21,105 @@ class Utilities:
                 if 2 <= range[0] and 2 <= range[1] and range[0] <= range[1]:
                     return range
 
+    @staticmethod
+    def getEstimatedCost(n: int) -> float:
+        """Cumulative estimated total stopping time of all values in [1, n)."""
+        # Heuristically, the total stopping time of n averages 2 / ln(4/3) * ln(n) ~ 6.95 * ln(n).
+        # Integrated: 6.95 * (n * ln(n) - n), plus a constant per-sequence overhead of 1.
+        STOPPING_TIME_FACTOR: float = 2 / log(4 / 3)
+        if n <= 1:
+            return 0.0
+        return STOPPING_TIME_FACTOR * (n * log(n) - n) + n
+
+    @staticmethod
+    def getShards(
+        value_range: Tuple[int, int], shard_count: int
+    ) -> List[Tuple[int, int]]:
+        """Splits a range into contiguous shards of roughly equal estimated total stopping time."""
+        start, end = value_range
+        if start == end or shard_count <= 1:
+            return [value_range]
+        base_cost: float = Utilities.getEstimatedCost(start)
+        total_cost: float = Utilities.getEstimatedCost(end) - base_cost
+        bounds: List[int] = [start]
+        for i in range(1, shard_count):
+            target: float = base_cost + total_cost * i / shard_count
+
+            # Smallest boundary whose cumulative cost reaches the target.
+            low, high = bounds[-1], end
+            while low < high:
+                mid: int = (low + high) // 2
+                if Utilities.getEstimatedCost(mid) < target:
+                    low = mid + 1
+                else:
+                    high = mid
+            bounds.append(low)
+        bounds.append(end)
+
+        # Drop empty shards, which occur when there are more shards than values.
+        return [
+            (bounds[i], bounds[i + 1])
+            for i in range(shard_count)
+            if bounds[i] < bounds[i + 1]
+        ]
+
+    @staticmethod
+    def mergeImageData(shards: List["ImageData"]) -> "ImageData":
+        """Merges the image data of multiple shards into a single `ImageData`."""
+        if not shards:
+            raise ValueError("Cannot merge an empty list of shards.")
+        segment_count: np.uint32 = np.uint32(sum(int(s.segment_count) for s in shards))
+        image_bytes: npt.NDArray[Any] = np.concatenate([s.image_bytes for s in shards])
+        populated: List[ImageData] = [s for s in shards if s.segment_count > 0]
+        bounding_box: Tuple[float, float, float, float] = (
+            (
+                min(s.bounding_box[0] for s in populated),
+                min(s.bounding_box[1] for s in populated),
+                max(s.bounding_box[2] for s in populated),
+                max(s.bounding_box[3] for s in populated),
+            )
+            if populated
+            else (0.0, 0.0, 0.0, 0.0)
+        )
+        return ImageData(
+            segment_count, shards[0].background_color, image_bytes, bounding_box
+        )
+
+    @staticmethod
+    def mergeAnalytics(shards: List["AnalyticsData"]) -> "AnalyticsData":
+        """Merges the trajectory statistics of contiguous shards, given in order, into a single `AnalyticsData`."""
+        if not shards:
+            raise ValueError("Cannot merge an empty list of shards.")
+
+        def mergeHistograms(histograms: List[npt.NDArray[np.uint64]]) -> npt.NDArray[np.uint64]:
+            merged: npt.NDArray[np.uint64] = np.zeros(
+                max(len(h) for h in histograms), dtype=np.uint64
+            )
+            for histogram in histograms:
+                merged[: len(histogram)] += histogram
+            return merged
+
+        def mergeRecords(records: List[npt.NDArray[Any]]) -> npt.NDArray[Any]:
+            # Each shard only holds its own records, keep those that beat every shard before them.
+            merged: npt.NDArray[Any] = np.concatenate(records)
+            if merged.shape[0] == 0:
+                return merged
+            best_before: npt.NDArray[np.uint64] = np.concatenate(
+                ([np.uint64(0)], np.maximum.accumulate(merged["value"])[:-1])
+            )
+            return merged[merged["value"] > best_before]
+
+        return AnalyticsData(
+            shards[0].start,
+            np.concatenate([s.stopping_times for s in shards]),
+            np.concatenate([s.max_values for s in shards]),
+            np.concatenate([s.odd_steps for s in shards]),
+            mergeHistograms([s.stopping_time_histogram for s in shards]),
+            mergeHistograms([s.odd_step_histogram for s in shards]),
+            mergeRecords([s.stopping_time_records for s in shards]),
+            mergeRecords([s.max_value_records for s in shards]),
+        )
+
 
 @dataclass
 class ImageData:
@@ -28,3 +128,37 @@ class ImageData:
     segment_count: np.uint32
     background_color: npt.NDArray[np.uint8]
     image_bytes: npt.NDArray[Any]
+
+    # Stored as (min_x, min_y, max_x, max_y).
+    bounding_box: Tuple[float, float, float, float]
+
+
+@dataclass
+class BatchResult:
+    """Holds the response to a single entry of a batch request."""
+
+    index: int
+    payload: bytes
+
+    # Why the entry failed. None if it has not.
+    error: Optional[str]
+
+
+@dataclass
+class AnalyticsData:
+    """Holds per-n trajectory statistics, with the ith index of every column being for n = start + i."""
+
+    RECORD_DTYPE: ClassVar[np.dtype[Any]] = np.dtype([("n", "<u8"), ("value", "<u8")])
+
+    start: int
+    stopping_times: npt.NDArray[np.uint32]
+    max_values: npt.NDArray[np.uint64]
+    odd_steps: npt.NDArray[np.uint32]
+
+    # Indexed by stopping time / odd step count.
+    stopping_time_histogram: npt.NDArray[np.uint64]
+    odd_step_histogram: npt.NDArray[np.uint64]
+
+    # Every n whose value beats that of all n before it, in order. Of `RECORD_DTYPE`.
+    stopping_time_records: npt.NDArray[Any]
+    max_value_records: npt.NDArray[Any]